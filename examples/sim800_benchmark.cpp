@@ -0,0 +1,184 @@
+/**
+ * Throughput benchmark.
+ *
+ * Brings up the modem and measures HTTP GET, HTTP POST, TCP
+ * send/receive against an echo server and (with BENCH_OTA) an
+ * HTTP download into the OTA partition. GET runs once more into a
+ * sink that stalls BENCH_SINK_DELAY ms per write, inline and through
+ * a sim800_pipe on the other core. For each run it prints
+ * payload bytes, wall time, bytes/sec and the number of AT round
+ * trips it took, so changes to the library can be compared on the
+ * same cell. Every round is repeated at each UART rate from 115200
+ * up to SIM800_BAUD_MAX.
+ *
+ * Copy config.h.template to config.h and fill in the URLs.
+ *
+ * == LICENSE ==
+ * Copyright 2015 ubirch GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include <sim800.h>
+#include <sim800_pipe.h>
+#include "config.h"
+
+#ifndef BENCH_POST_SIZE
+#   define BENCH_POST_SIZE 4096
+#endif
+#ifndef BENCH_TCP_SIZE
+#   define BENCH_TCP_SIZE 1024
+#endif
+#ifndef BENCH_SINK_DELAY
+#   define BENCH_SINK_DELAY 20
+#endif
+
+// counts what HTTP_get writes and throws it away
+class NullStream : public Stream {
+public:
+    size_t count = 0;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush() {}
+    size_t write(uint8_t) { count++; return 1; }
+    size_t write(const uint8_t *, size_t size) { count += size; return size; }
+};
+
+// like an SD card that needs a while for every block
+class SlowStream : public NullStream {
+public:
+    size_t write(const uint8_t *buffer, size_t size) {
+        delay(BENCH_SINK_DELAY);
+        return NullStream::write(buffer, size);
+    }
+};
+
+sim800 modem;
+static char payload[BENCH_POST_SIZE];
+
+static uint32_t started, commands;
+
+static void bench_start() {
+    commands = modem.at_commands;
+    started = millis();
+}
+
+static void bench_report(const char *name, uint32_t bytes, uint16_t status) {
+    uint32_t ms = millis() - started;
+    Serial.printf("%-8s status %4u  %7u bytes  %6u ms  %7u B/s  %4u AT\n",
+                  name, status, bytes, ms, ms ? (uint32_t) (bytes * 1000ULL / ms) : 0,
+                  modem.at_commands - commands);
+}
+
+static void bench_http_get() {
+    NullStream sink;
+    unsigned long int length = 0;
+    bench_start();
+    uint16_t status = modem.HTTP_get(BENCH_GET_URL, &length, sink);
+    bench_report("GET", sink.count, status);
+}
+
+static void bench_slow_sink() {
+    unsigned long int length = 0;
+    SlowStream inline_sink;
+    bench_start();
+    uint16_t status = modem.HTTP_get(BENCH_GET_URL, &length, inline_sink);
+    bench_report("GET slow", inline_sink.count, status);
+
+    // loop() runs on core 1, the writer goes to core 0
+    static SlowStream piped_sink;
+    static sim800_pipe pipe(piped_sink, SIM800_PIPE_DEPTH, 0);
+    piped_sink.count = 0;
+    sim800_pipe_stats stats;
+    bench_start();
+    status = modem.HTTP_get(BENCH_GET_URL, &length, pipe);
+    bench_report("GET pipe", piped_sink.count, status);
+    pipe.report(stats);
+    Serial.printf("         reader stalled %u ms, writer stalled %u ms, writing %u ms, max fill %u\n",
+                  stats.read_stall_ms, stats.write_stall_ms, stats.write_ms, stats.max_fill);
+}
+
+static void bench_http_post() {
+    unsigned long int length = 0;
+    memset(payload, 'x', sizeof(payload));
+    bench_start();
+    uint16_t status = modem.HTTP_post(BENCH_POST_URL, &length, payload, sizeof(payload));
+    bench_report("POST", sizeof(payload), status);
+}
+
+static void bench_tcp() {
+    unsigned long int accepted = 0;
+    size_t received = 0;
+    bench_start();
+    if (modem.connect(BENCH_TCP_HOST, BENCH_TCP_PORT)) {
+        modem.send(payload, BENCH_TCP_SIZE, accepted);
+        uint32_t deadline = millis() + 10000;
+        while (received < accepted && millis() < deadline)
+            received += modem.receive(payload + received, accepted - received);
+        modem.disconnect();
+    }
+    bench_report("TCP", accepted + received, received == BENCH_TCP_SIZE ? 200 : 0);
+}
+
+#ifdef BENCH_OTA
+// downloads into the next OTA partition but never marks it bootable
+static void bench_ota() {
+    unsigned long int length = 0;
+    esp_ota_handle_t handle = 0;
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    bench_start();
+    uint16_t status = modem.HTTP_get(BENCH_GET_URL, &length);
+    size_t written = 0;
+    if (status == 200 && esp_ota_begin(partition, OTA_SIZE_UNKNOWN, &handle) == ESP_OK) {
+        written = modem.HTTP_read_ota(handle, 0, length);
+        esp_ota_end(handle);
+    }
+    bench_report("OTA", written, status);
+}
+#endif
+
+void setup() {
+    Serial.begin(115200);
+    modem.setAPN(F(SIM800_APN), F(SIM800_USER), F(SIM800_PASS));
+    if (!modem.gsm_init()) {
+        Serial.println("SIM800 init failed");
+        while (1) delay(1000);
+    }
+    modem.enableGPRS();
+    Serial.printf("bring-up: AT %u ms, SIM %u ms, registered %u ms, IP %u ms\n",
+                  modem.bringup_time.at_ms, modem.bringup_time.sim_ms,
+                  modem.bringup_time.registered_ms, modem.bringup_time.ip_ms);
+}
+
+static const uint32_t rates[] = {115200, 230400, 460800};
+
+void loop() {
+    for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        if (rates[i] > SIM800_BAUD_MAX) break;
+        if (!modem.set_baud(rates[i])) {
+            Serial.printf("%u baud failed\n", rates[i]);
+            continue;
+        }
+        Serial.printf("--- %u baud\n", rates[i]);
+        bench_http_get();
+        bench_slow_sink();
+        bench_http_post();
+        bench_tcp();
+#ifdef BENCH_OTA
+        bench_ota();
+#endif
+    }
+    delay(10000);
+}
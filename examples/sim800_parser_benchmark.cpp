@@ -0,0 +1,168 @@
+/**
+ * Response parser micro-benchmark.
+ *
+ * Feeds a recorded modem transcript through readline(), is_urc(),
+ * expect() and expect_scan() and prints ns/line, ns/byte and heap
+ * blocks allocated per operation. The UART is switched to internal
+ * loopback, so no modem is needed (keep it powered off, TX is still
+ * driven). Every line is completely in the RX buffer before the
+ * clock starts, so the numbers are parser cost only, not wire time.
+ * test/host/bench_parser.cpp runs the same transcript on a PC.
+ *
+ * == LICENSE ==
+ * Copyright 2015 ubirch GmbH
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <sim800.h>
+
+#define ROUNDS 200
+
+// replies and URCs as captured from a SIM800H during bring-up and HTTP
+static const char *const transcript[] = {
+    "OK",
+    "RDY",
+    "+CPIN: READY",
+    "Call Ready",
+    "SMS Ready",
+    "+CSMINS: 0,1",
+    "+CSQ: 18,0",
+    "+CREG: 0,1",
+    "+CGATT: 1",
+    "+COPS: 0,2,\"25001\"",
+    "+SAPBR: 1,1,\"10.173.12.201\"",
+    "+HTTPACTION: 0,200,18342",
+    "+HTTPREAD: 64",
+    "+CIPRXGET: 1,0",
+    "+CIPRXGET: 2,0,128,0",
+    "*PSUTTZ: 2017,4,20,12,5,30,\"+8\",0",
+    "+CCLK: \"17/04/20,12:05:31+08\"",
+    "+CBC: 0,87,4125",
+    "DATA ACCEPT: 0,512",
+};
+
+#define LINES (sizeof(transcript) / sizeof(transcript[0]))
+
+// expose the protected parser entry points
+class bench_sim800 : public sim800 {
+public:
+    using sim800::is_urc;
+    using sim800::_serial;
+};
+
+bench_sim800 modem;
+
+static size_t allocated_blocks() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    return info.allocated_blocks;
+}
+
+// push one line through the loopback and wait until all of it is back
+static void feed(const char *line) {
+    size_t len = strlen(line) + 2;
+    modem._serial.print(line);
+    modem._serial.print("\r\n");
+    while ((size_t) modem._serial.available() < len) delayMicroseconds(50);
+}
+
+static void report(const char *name, uint64_t cycles, size_t lines, size_t bytes, int blocks) {
+    uint64_t ns = cycles * 1000 / ESP.getCpuFreqMHz();
+    Serial.printf("%-12s %8u ns/line  %6u ns/byte  %d allocs/op\n", name,
+                  (uint32_t) (ns / lines), (uint32_t) (ns / bytes), blocks / (int) lines);
+}
+
+static void bench_readline() {
+    char buf[SIM800_BUFSIZE];
+    uint64_t cycles = 0;
+    size_t bytes = 0, lines = 0;
+    size_t blocks = allocated_blocks();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < LINES; i++) {
+            feed(transcript[i]);
+            uint32_t start = ESP.getCycleCount();
+            bytes += modem.readline(buf, SIM800_BUFSIZE - 1, SIM800_SERIAL_TIMEOUT) + 2;
+            cycles += ESP.getCycleCount() - start;
+            lines++;
+        }
+    }
+    report("readline", cycles, lines, bytes, (int) (allocated_blocks() - blocks));
+}
+
+static void bench_is_urc() {
+    uint64_t cycles = 0;
+    size_t bytes = 0, lines = 0;
+    size_t blocks = allocated_blocks();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < LINES; i++) {
+            size_t len = strlen(transcript[i]);
+            uint32_t start = ESP.getCycleCount();
+            modem.is_urc(transcript[i], len);
+            cycles += ESP.getCycleCount() - start;
+            bytes += len;
+            lines++;
+        }
+    }
+    report("is_urc", cycles, lines, bytes, (int) (allocated_blocks() - blocks));
+}
+
+static void bench_expect() {
+    uint64_t cycles = 0;
+    size_t lines = 0;
+    size_t blocks = allocated_blocks();
+    for (int r = 0; r < ROUNDS; r++) {
+        feed("Call Ready");// one URC to skip before the answer
+        feed("OK");
+        uint32_t start = ESP.getCycleCount();
+        modem.expect_OK();
+        cycles += ESP.getCycleCount() - start;
+        lines += 2;
+    }
+    report("expect", cycles, lines, lines * 8, (int) (allocated_blocks() - blocks));
+}
+
+static void bench_expect_scan() {
+    uint64_t cycles = 0;
+    size_t lines = 0;
+    size_t blocks = allocated_blocks();
+    for (int r = 0; r < ROUNDS; r++) {
+        unsigned short int status = 0;
+        unsigned long int length = 0;
+        feed("+HTTPACTION: 0,200,18342");
+        uint32_t start = ESP.getCycleCount();
+        modem.expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length);
+        cycles += ESP.getCycleCount() - start;
+        lines++;
+    }
+    report("expect_scan", cycles, lines, lines * 26, (int) (allocated_blocks() - blocks));
+}
+
+void setup() {
+    Serial.begin(115200);
+    modem.begin();
+    uart_set_loop_back((uart_port_t) SIM800_UART, true);
+    delay(100);
+    while (modem._serial.available()) modem._serial.read();
+}
+
+void loop() {
+    bench_readline();
+    bench_is_urc();
+    bench_expect();
+    bench_expect_scan();
+    Serial.println();
+    delay(5000);
+}
@@ -1,56 +1,149 @@
 #include <Arduino.h>
 #include "sim800.h"
+#include "sim800_cbor.h"
+#include "sim800_pipe.h"
+#include "sim800_debug.h"
 
 #define sscanf_P(i, p, ...)    sscanf((i), (p), __VA_ARGS__)
 #define println_param(prefix, p) print(F(prefix)); print(F(",\"")); print(p); println(F("\""));
 
-#ifdef DEBUG_SIM800
-#define PRINT(s) Serial.print(F(s))
-#define PRINTLN(s) Serial.println(F(s))
-#define DEBUG(...) Serial.print(__VA_ARGS__)
-#define DEBUGQ(...) Serial.print("'"); Serial.print(__VA_ARGS__); Serial.print("'")
-#define DEBUGLN(...) Serial.println(__VA_ARGS__)
-#define DEBUGQLN(...) Serial.print("'"); Serial.print(__VA_ARGS__); Serial.println("'")
+#ifdef SIM800_TRACE
+#define TRACE(dir, data, len) trace(dir, (const uint8_t *) (data), len)
 #else
-#define PRINT(s)
-#define PRINTLN(s)
-#define DEBUG(...)
-#define DEBUGQ(...)
-#define DEBUGLN(...)
-#define DEBUGQLN(...)
+#define TRACE(dir, data, len) ((void) (data))// keeps a byte read only for the trace used
 #endif
 
-sim800::sim800(){}
+sim800::sim800(const sim800_board &board) : _serial(board.uart), _board(board)
+{
+	_lock = xSemaphoreCreateRecursiveMutex();
+	stats_reset();
+	clear_rtt();
+}
 
+// the driver RX buffer can only be sized before the UART starts, a second
+// begin(), e.g. the fallback to SIM800_BAUD in gsm_init(), only changes the rate
 void sim800::begin()
 {
-	_serial.begin(_serialSpeed, SERIAL_8N1, SIM800_RX, SIM800_TX);
+	hold h(*this);
+	if(_uart_started)
+	{
+		_serial.updateBaudRate(_serialSpeed);
+		return;
+	}
+	_serial.setRxBufferSize(SIM800_RX_BUFSIZE);
+	_serial.begin(_serialSpeed, SERIAL_8N1, _board.rx, _board.tx);
+	_uart_started = true;
 #ifdef DEBUG_SIM800
-	printf("\n_serial.begin(%d, %d, %d, %d)\n", _serialSpeed, SERIAL_8N1, SIM800_RX, SIM800_TX);
+	printf("\n_serial.begin(%d, %d, %d, %d)\n", _serialSpeed, SERIAL_8N1, _board.rx, _board.tx);
 #endif
+	if(_board.rts >= 0 && _board.cts >= 0)
+	{
+		uart_set_pin((uart_port_t) _board.uart, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, _board.rts, _board.cts);
+		uart_set_hw_flow_ctrl((uart_port_t) _board.uart, _flow_control ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE, SIM800_RTS_THRESHOLD);
+	}
+	if(_board.dtr >= 0)
+	{
+		pinMode(_board.dtr, OUTPUT);
+		digitalWrite(_board.dtr, _asleep && _sleep_mode == SIM800_SLEEP_DTR ? HIGH : LOW);
+	}
+	if(_board.ri >= 0)
+	{
+		pinMode(_board.ri, INPUT_PULLUP);
+		attachInterruptArg(_board.ri, ri_isr, this, FALLING);
+	}
+}
+
+// the modem is switched first, the UART follows only if it agreed
+bool sim800::flow_control(bool enable)
+{
+	hold h(*this);
+	if(_board.rts < 0 || _board.cts < 0) enable = false;
+	bool ok = enable ? expect_AT_OK(F("+IFC=2,2")) : expect_AT_OK(F("+IFC=0,0"));
+	_flow_control = enable && ok;
+	if(_board.rts >= 0 && _board.cts >= 0)
+	{
+		uart_set_hw_flow_ctrl((uart_port_t) _board.uart, _flow_control ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE, SIM800_RTS_THRESHOLD);
+	}
+	return ok;
+}
+
+static const uint32_t _baud_rates[] = {460800, 230400, 115200, 57600};
+
+bool sim800::set_baud(uint32_t baud)
+{
+	hold h(*this);
+	uint32_t old = _serialSpeed;
+	if(baud == old) return true;
+	print(F("AT+IPR="));
+	println(baud);
+	if(!expect_OK()) return false;// still on the old rate
+	_serialSpeed = baud;
+	_serial.updateBaudRate(baud);
+	pause(SIM800_POLL_INTERVAL);
+	if(probe_baud())
+	{
+	#ifdef DEBUG_PROGRESS
+		PRINT("!!! SIM800 baud ");
+		DEBUGLN(baud);
+	#endif
+		return true;
+	}
+	// the link is unreliable at this rate, ask for the old one and go back
+	print(F("AT+IPR="));
+	println(old);
+	expect_OK();
+	_serialSpeed = old;
+	_serial.updateBaudRate(old);
+	pause(SIM800_POLL_INTERVAL);
+	wait_ready(SIM800_SERIAL_TIMEOUT);
+	return false;
+}
+
+// a garbled byte turns OK into something else, so every probe must match
+bool sim800::probe_baud()
+{
+	for(uint8_t i = 0; i < SIM800_BAUD_PROBES; i++)
+	{
+		if(!expect_AT_OK(F(""), 500)) return false;
+	}
+	return true;
+}
+
+uint32_t sim800::negotiate_baud()
+{
+	hold h(*this);
+	for(uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++)
+	{
+		if(_baud_rates[i] > SIM800_BAUD_MAX) continue;
+		if(_baud_rates[i] <= _serialSpeed || set_baud(_baud_rates[i])) break;
+	}
+	return _serialSpeed;
 }
 
 bool sim800::reset(bool flag_reboot)
 {
+	hold h(*this);
 	bool ok = false;
 	if(flag_reboot)
 	{
+		urc_pending &= ~(1UL << URC_RDY);
+		booting();
 		ok = expect_AT_OK(F("+CFUN=1,1"));
-		vTaskDelay(5000 / portTICK_RATE_MS);
+		// RDY is only sent with a fixed baud rate, fall back to probing
+		if(!wait_urc(URC_RDY, SIM800_BOOT_TIMEOUT / 2)) wait_ready();
 	}
 	ok = expect_AT_OK(F(""));if(!ok)expect_AT_OK(F(""));
 	println(F("ATZ"));
-	vTaskDelay(1000 / portTICK_RATE_MS);
-	ok = expect_OK(5000);//if(!ok){println(F("ATZ"));vTaskDelay(1000 / portTICK_RATE_MS);expect_OK(5000);}
+	ok = expect_OK(5000);
 	println(F("ATE0"));
-	vTaskDelay(1000 / portTICK_RATE_MS);
-	ok = expect_OK(5000);if(!ok){println(F("ATE0"));vTaskDelay(1000 / portTICK_RATE_MS);ok = expect_OK(5000);}
+	ok = expect_OK(5000);if(!ok){println(F("ATE0"));ok = expect_OK(5000);}
 	ok = expect_AT_OK(F("+CFUN=1"));if(!ok)expect_AT_OK(F("+CFUN=1"));
 	return ok;
 }
 
 bool sim800::wakeup()
 {
+	hold h(*this);
 #ifdef DEBUG_AT
 	PRINTLN("!!! SIM800 wakeup");
 #endif
@@ -62,25 +155,25 @@ bool sim800::wakeup()
 		#ifdef DEBUG_AT
 			PRINTLN("!!! SIM800 using PWRKEY wakeup procedure");
 		#endif
-			pinMode(SIM800_KEY, OUTPUT);
-			pinMode(SIM800_PS, INPUT);
-			if(digitalRead(SIM800_PS) == LOW)
+			booting();
+			pinMode(_board.key, OUTPUT);
+			pinMode(_board.ps, INPUT);
+			if(digitalRead(_board.ps) == LOW)
 			{
 				do {
-				digitalWrite(SIM800_KEY, HIGH);
-				vTaskDelay(3000 / portTICK_RATE_MS);
-				} while (digitalRead(SIM800_PS) == LOW);
+				digitalWrite(_board.key, HIGH);
+				} while (!wait_pin(_board.ps, HIGH, SIM800_PWRKEY_TIMEOUT));
 			}
 			else
 			{
 				do {
-				digitalWrite(SIM800_KEY, LOW);
-				vTaskDelay(1100 / portTICK_RATE_MS);
-				digitalWrite(SIM800_KEY, HIGH);
-				vTaskDelay(3000 / portTICK_RATE_MS);
-				} while (digitalRead(SIM800_PS) == LOW);
+				digitalWrite(_board.key, LOW);
+				pause(1100);
+				digitalWrite(_board.key, HIGH);
+				} while (!wait_pin(_board.ps, HIGH, SIM800_PWRKEY_TIMEOUT));
 			}
-			pinMode(SIM800_KEY, INPUT_PULLUP);// make pin unused (do not leak)
+			pinMode(_board.key, INPUT_PULLUP);// make pin unused (do not leak)
+			if(!wait_ready()) return false;
 		#ifdef DEBUG_AT
 			PRINTLN("!!! SIM800 ok");
 		#endif
@@ -102,8 +195,16 @@ void sim800::setAPN(const __FlashStringHelper *apn, const __FlashStringHelper *u
 	_pass = pass;
 }
 
+// the table must be sorted by plmn and stay valid while in use
+void sim800::setAPNTable(const sim800_apn *table, size_t len)
+{
+	_apn_table = table;
+	_apn_table_len = len;
+}
+
 bool sim800::unlock(const __FlashStringHelper *pin)
 {
+	hold h(*this);
 	print(F("AT+CPIN="));
 	println(pin);
 	return expect_OK();
@@ -111,71 +212,92 @@ bool sim800::unlock(const __FlashStringHelper *pin)
 
 bool sim800::time(char *date, char *time, char *tz)
 {
+	hold h(*this);
 	println(F("AT+CCLK?"));
-	return expect_scan(F("+CCLK: \"%8s,%8s%3s\""), date, time, tz);
+	return expect_scan(F("+CCLK: \"%8s,%8s%3s\""), date, time, tz) && expect_OK();
 }
 
 bool sim800::IMEI(char *imei)
 {
+	hold h(*this);
+	if(session_valid && session.imei[0])
+	{
+		strcpy(imei, session.imei);
+		return true;
+	}
 	println(F("AT+GSN"));
-	expect_scan(F("%s"), imei);
-	return expect_OK();
+	bool ok = expect_scan(F("%15s"), imei);
+	return expect_OK() && ok;
 }
 
 bool sim800::CIMI(char *cimi)//ID sim card
 {
+	hold h(*this);
 	println(F("AT+CIMI"));
-	expect_scan(F("%s"), cimi);
-	return expect_OK();
+	bool ok = expect_scan(F("%15s"), cimi);
+	return expect_OK() && ok;
 }
 
-bool sim800::battery(uint16_t &bat_status, uint16_t &bat_percent, uint16_t &bat_voltage) {
-  println(F("AT+CBC"));
-  if(!expect_scan(F("+CBC: %d,%d,%d"), &bat_status, &bat_percent, &bat_voltage)) {
-    Serial.println(F("BAT status lookup failed"));
-  }
-  return expect_OK();
+bool sim800::battery(uint16_t &bat_status, uint16_t &bat_percent, uint16_t &bat_voltage)
+{
+	hold h(*this);
+	println(F("AT+CBC"));
+	bool ok = expect_scan(F("+CBC: %hu,%hu,%hu"), &bat_status, &bat_percent, &bat_voltage);
+	if (!ok)
+	{
+	#ifdef DEBUG_AT
+		PRINTLN("BAT status lookup failed");
+	#endif
+	}
+	return expect_OK() && ok;
 }
 
-bool sim800::location(char *&lat, char *&lon, char *&date, char *&time)
+bool sim800::location(sim800_location &loc)
 {
-	uint16_t loc_status;
-	char reply[64];
+	hold h(*this);
+	char buf[SIM800_BUFSIZE];
+	uint16_t loc_status = 1;
 	println(F("AT+CIPGSMLOC=1,1"));
-	vTaskDelay(3000 / portTICK_RATE_MS);
-	if (!expect_scan(F("+CIPGSMLOC: %d,%s"), &loc_status, reply, 10000)) {
+	expect_line(buf, 10000);
+	if (sscanf_P(buf, PSTR("+CIPGSMLOC: %hu,%11[^,],%11[^,],%10[^,],%8s"), &loc_status, loc.lon, loc.lat, loc.date, loc.time) != 5) {
 		#ifdef DEBUG_AT
 		Serial.println(F("GPS lookup failed"));
 		#endif
-	} else {
-		lon = strdup(strtok(reply, ","));
-		lat = strdup(strtok(NULL, ","));
-		date = strdup(strtok(NULL, ","));
-		time = strdup(strtok(NULL, ","));
+		loc_status = 1;
 	}
-	return expect_OK() && loc_status == 0 && lat && lon;
+	return expect_OK() && loc_status == 0;
+}
+
+bool sim800::registration(uint16_t &stat)
+{
+	hold h(*this);
+	println(F("AT+CREG?"));
+	return expect_scan(F("+CREG: %*hu,%hu"), &stat) && expect_OK();
 }
 
 bool sim800::shutdown()
 {
+	hold h(*this);
 #ifdef DEBUG_AT
 	PRINTLN("!!! SIM800 shutdown");
 #endif
 
+	urc_pending &= ~(1UL << URC_RDY);
+	booting();
 	bool reboot = expect_AT_OK(F("+CFUN=1,1"));
-	if(reboot) vTaskDelay(5000 / portTICK_RATE_MS);
+	if(reboot) wait_urc(URC_RDY, SIM800_BOOT_TIMEOUT / 2);
 	else
 	{
-		if (digitalRead(SIM800_PS) == HIGH)
+		if (digitalRead(_board.ps) == HIGH)
 		{
 		#ifdef DEBUG_AT
 			PRINTLN("!!! SIM800 shutdown using PWRKEY");
 		#endif
-			pinMode(SIM800_KEY, OUTPUT);
-			digitalWrite(SIM800_KEY, HIGH);
-			vTaskDelay(10 / portTICK_RATE_MS);
-			digitalWrite(SIM800_KEY, LOW);
-			pinMode(SIM800_KEY, INPUT_PULLUP);
+			pinMode(_board.key, OUTPUT);
+			digitalWrite(_board.key, HIGH);
+			pause(10);
+			digitalWrite(_board.key, LOW);
+			pinMode(_board.key, INPUT_PULLUP);
 		}
 	}
 #ifdef DEBUG_AT
@@ -184,17 +306,20 @@ bool sim800::shutdown()
 	return true;
 }
 
-bool sim800::registerNetwork(uint16_t timeout)
+bool sim800::registerNetwork(uint32_t timeout)
 {
+	hold h(*this);
 #ifdef DEBUG_AT
 	PRINTLN("!!! SIM800 waiting for network registration");
 #endif
-	expect_AT_OK(F(""));
-	while (timeout -= 1000)
+	sim800_deadline deadline(timeout);
+	expect_AT_OK(F(""), deadline.remaining(SIM800_SERIAL_TIMEOUT));
+	uint8_t attempt = 0;
+	do
 	{
 		unsigned short int n = 0;
 		println(F("AT+CREG?"));
-		expect_scan(F("+CREG: 0,%hu"), &n);
+		expect_scan(F("+CREG: 0,%hu"), &n, deadline.remaining(answer_wait(SIM800_SERIAL_TIMEOUT)));
 	#ifdef DEBUG_PROGRESS
 		switch (n)
 		{
@@ -228,24 +353,44 @@ bool sim800::registerNetwork(uint16_t timeout)
 		#endif
 			return true;
 		}
-		vTaskDelay(1000 / portTICK_RATE_MS);
+		pause(deadline.remaining(retry_after(attempt++, 1000)));
 	}
+	while(!deadline.expired());
 	return false;
 }
 
-bool sim800::enableGPRS(uint16_t timeout)
+// the whole sequence, not each step, has to finish within timeout
+bool sim800::enableGPRS(uint32_t timeout)
 {
-	expect_AT(F("+CIPSHUT"), F("SHUT OK"), 5000);
+	hold h(*this);
+	sim800_deadline deadline(timeout);
+	expect_AT(F("+CIPSHUT"), F("SHUT OK"), deadline.remaining(5000));
 	expect_AT_OK(F("+CIPMUX=1")); // enable multiplex mode
 	expect_AT_OK(F("+CIPRXGET=1")); // we will receive manually
 	bool attached = false;
-	while (!attached && timeout > 0)
+	uint8_t attempt = 0;
+	while (!attached && !deadline.expired())
 	{
-		attached = expect_AT_OK(F("+CGATT=1"), 10000);
-		vTaskDelay(1000 / portTICK_RATE_MS);
-		timeout -= 1000;
+		attached = expect_AT_OK(F("+CGATT=1"), deadline.remaining(10000));
+		if (!attached) pause(deadline.remaining(retry_after(attempt++, 1000)));
 	}
 	if (!attached) return false;
+	if (!set_bearer()) return false;
+	expect_AT_OK(F("+SAPBR=1,1"), deadline.remaining(30000));// open GPRS context
+	attempt = 0;
+	do
+	{
+		println(F("AT+CGATT?"));
+		attached = expect(F("+CGATT: 1"), deadline.remaining(answer_wait(SIM800_SERIAL_TIMEOUT)));
+		if (!attached) pause(deadline.remaining(retry_after(attempt++, 1000)));
+	}
+	while(!attached && !deadline.expired());
+	return attached;
+}
+
+// set bearer profile type and access point name
+bool sim800::set_bearer()
+{
 	if (!expect_AT_OK(F("+SAPBR=3,1,\"CONTYPE\",\"GPRS\""), 10000)) return false;
 	if(_apn)// set bearer profile access point name
 	{
@@ -268,19 +413,12 @@ bool sim800::enableGPRS(uint16_t timeout)
 			if (!expect_OK()) return false;
 		}
 	}
-	expect_AT_OK(F("+SAPBR=1,1"), 30000);// open GPRS context
-	do
-	{
-		println(F("AT+CGATT?"));
-		attached = expect(F("+CGATT: 1"));
-		vTaskDelay(1000 / portTICK_RATE_MS);
-	}
-	while(--timeout && !attached);
-	return attached;
+	return true;
 }
 
 bool sim800::disableGPRS()
 {
+	hold h(*this);
 	expect_AT(F("+CIPSHUT"), F("SHUT OK"));
 	if (!expect_AT_OK(F("+SAPBR=0,1"), 30000)) return false;
 	return expect_AT_OK(F("+CGATT=0"));
@@ -288,27 +426,35 @@ bool sim800::disableGPRS()
 
 unsigned short int sim800::HTTP_get(const char *url, unsigned long int *length)
 {
+	hold h(*this);
 	expect_AT_OK(F("+HTTPTERM"));
-	vTaskDelay(100 / portTICK_RATE_MS);
+	pause(100);
 	if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
 	if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
 	println_param("AT+HTTPPARA=\"URL\"", url);
 	if (!expect_OK()) return 1110;
 	if (!expect_AT_OK(F("+HTTPACTION=0"))) return 1004;
-	unsigned short int status;
-	expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length, 60000);
+	unsigned short int status = 0;
+	expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, length, 60000);
 	return status;
 }
 
 unsigned short int sim800::HTTP_get(const char *url, unsigned long int *length, STREAM &file)
 {
+	hold h(*this);
+	*length = 0;
 	unsigned short int status = HTTP_get(url, length);
-	if (length == 0) return status;
-	char *buffer = (char *) malloc(SIM800_BUFSIZE);
+	if (*length == 0) return status;
+	char *buffer = (char *) acquire(SIM800_BUF_BULK, GSM_MAX_BUFFSIZE);
+	if (!buffer) return 1006;
 	uint32_t pos = 0;
+	uint8_t failed = 0;
 	do
 	{
-		size_t r = HTTP_read(buffer, pos, SIM800_BUFSIZE);
+		link_sample();
+		uint8_t band = link_band();
+		uint32_t start = millis();
+		size_t r = HTTP_read(buffer, pos, link_chunk(GSM_MAX_BUFFSIZE));
 	#ifdef DEBUG_PROGRESS
 		if((pos % 10240) == 0)
 		{
@@ -318,19 +464,75 @@ unsigned short int sim800::HTTP_get(const char *url, unsigned long int *length,
 		else if(pos % (1024) == 0)
 		{PRINT("<");}
 	#endif
+		if (r == (size_t) -1) break;
+		if (!r)// the range is read again, nothing of it was written yet
+		{
+			if (++failed > link_retries()) break;
+			pause(backoff(failed));
+			continue;
+		}
+		failed = 0;
+		link_account(band, r, millis() - start);
+		if (file.write(buffer, r) != r)
+		{
+			release(SIM800_BUF_BULK);
+			return 1012;
+		}
 		pos += r;
-		file.write(buffer, r);
 	}
 	while(pos < *length);
-	free(buffer);
+	release(SIM800_BUF_BULK);
+	if (pos < *length) return 1011;// the body was cut short
 	return status;
 }
 
+// the reader half of the pipe, a chunk is handed over once it is complete
+unsigned short int sim800::HTTP_get(const char *url, unsigned long int *length, sim800_pipe &pipe)
+{
+	hold h(*this);
+	*length = 0;
+	unsigned short int status = HTTP_get(url, length);
+	if (*length == 0) return status;
+	if (!pipe.open()) return 1006;
+	uint8_t *buffer = NULL;
+	uint32_t pos = 0;
+	uint8_t failed = 0;
+	while(pos < *length && !pipe.failed())
+	{
+		if (!buffer && !(buffer = pipe.get())) break;
+		link_sample();
+		uint8_t band = link_band();
+		uint32_t start = millis();
+		size_t r = HTTP_read((char *) buffer, pos, link_chunk(SIM800_PIPE_BUFSIZE));
+		if (r == (size_t) -1) break;
+		if (!r)
+		{
+			if (++failed > link_retries()) break;
+			pause(backoff(failed));
+			continue;
+		}
+		failed = 0;
+		link_account(band, r, millis() - start);
+		pos += r;
+		if (!pipe.put(buffer, r)) break;
+		buffer = NULL;
+	}
+	pipe.close(buffer);
+	if (pipe.failed()) return 1012;// the writer's last write may come up short after the loop
+	if (pos < *length) return 1011;
+	return status;
+}
+
+// read up to length bytes of the response body from offset start
 size_t sim800::HTTP_read(char *buffer, uint32_t start, size_t length)
 {
-	println(F("AT+HTTPREAD"));
-	unsigned long int available;
-	expect_scan(F("+HTTPREAD: %lu"), &available);
+	hold h(*this);
+	print(F("AT+HTTPREAD="));
+	print(start);
+	print(F(","));
+	println((uint32_t) length);
+	unsigned long int available = 0;
+	if (!expect_scan(F("+HTTPREAD: %lu"), &available)) return 0;
 #ifdef DEBUG_PACKETS
 	PRINT("~~~ PACKET: ");
 	DEBUGLN(available);
@@ -340,9 +542,8 @@ size_t sim800::HTTP_read(char *buffer, uint32_t start, size_t length)
 		PRINT("~~~ BUFFER_HTTPREAD: ");DEBUGLN(available);
 		return -1;//2148341393
 	}
-	size_t idx = 0;
-	if(available <= length) idx = read(buffer, (size_t) available);
-	else idx = read(buffer, length);
+	size_t n = available <= length ? (size_t) available : length;
+	size_t idx = read(buffer, n, SIM800_SERIAL_TIMEOUT + line_ms(n));
 	if(!expect_OK()) return 0;
 #ifdef DEBUG_PACKETS
 	PRINT("~~~ DONE: ");
@@ -351,24 +552,36 @@ size_t sim800::HTTP_read(char *buffer, uint32_t start, size_t length)
 	return idx;
 }
 
+// ranged reads of up to CRITICAL_BUFFER_HTTPREAD, smaller on a weak link,
+// until length bytes are in or the body ends
 size_t sim800::HTTP_read_ota(esp_ota_handle_t ota_handle, uint32_t start, size_t length)
 {
-	println(F("AT+HTTPREAD"));
-	unsigned long int available;
-	expect_scan(F("+HTTPREAD: %lu"), &available);
-#ifdef DEBUG_PACKETS
-	PRINT("~~~ OTA PACKET: ");
-	DEBUGLN(available);
-#endif
-	if(available > CRITICAL_BUFFER_HTTPREAD)
+	hold h(*this);
+	size_t idx = 0;
+	while(idx < length)
 	{
-		PRINT("~~~ OTA BUFFER_HTTPREAD: ");DEBUGLN(available);
-		return -1;//2148341393
+		size_t chunk = link_chunk(CRITICAL_BUFFER_HTTPREAD);
+		if(chunk > length - idx) chunk = length - idx;
+		print(F("AT+HTTPREAD="));
+		print(start + idx);
+		print(F(","));
+		println((uint32_t) chunk);
+		unsigned long int available = 0;
+		if(!expect_scan(F("+HTTPREAD: %lu"), &available)) break;
+	#ifdef DEBUG_PACKETS
+		PRINT("~~~ OTA PACKET: ");
+		DEBUGLN(available);
+	#endif
+		if(available > chunk)
+		{
+			PRINT("~~~ OTA BUFFER_HTTPREAD: ");DEBUGLN(available);
+			return -1;//2148341393
+		}
+		size_t r = read_ota(ota_handle, (size_t) available, SIM800_SERIAL_TIMEOUT + line_ms(available));
+		if(!expect_OK() || r != available) return 0;
+		idx += r;
+		if(available < chunk) break;// the body ended
 	}
-	size_t idx = 0;
-	if(available <= length) idx = read_ota(ota_handle, (size_t)available);
-	else idx = read_ota(ota_handle, length);
-	if(!expect_OK()) return 0;
 #ifdef DEBUG_PACKETS
 	PRINT("~~~ OTA DONE: ");
 	DEBUGLN(idx);
@@ -378,64 +591,52 @@ size_t sim800::HTTP_read_ota(esp_ota_handle_t ota_handle, uint32_t start, size_t
 
 unsigned short int sim800::HTTP_post(const char *url, unsigned long int *length)
 {
-	length = 0;
+	hold h(*this);
+	*length = 0;
 	expect_AT_OK(F("+HTTPTERM"));
-	vTaskDelay(100 / portTICK_RATE_MS);
+	pause(100);
 	if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
 	if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
 	println_param("AT+HTTPPARA=\"URL\"", url);
 	if (!expect_OK()) return 1110;
 	if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1001;
 	unsigned short int status;
-	expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length, 60000);
+	expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, length, 60000);
 	return status;
 }
 
+void sim800::setContentType(const char *type)
+{
+	_content_type = type;
+}
+
 unsigned short int sim800::HTTP_post(const char *url, unsigned long int *length, char *buffer, uint32_t size)
 {
-	expect_AT_OK(F("+HTTPTERM"));
-	vTaskDelay(100 / portTICK_RATE_MS);
-	length = 0;
-	if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-	if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-	if (!expect_AT_OK(F("+HTTPPARA=\"CONTENT\",\"application/x-www-form-urlencoded\""))) return 1102;
-	println_param("AT+HTTPPARA=\"URL\"", url);
-	if (!expect_OK()) return 1110;
-	print(F("AT+HTTPDATA="));
-	print(size);
-	print(F(","));
-	println((uint32_t) 3000);
-	if (!expect(F("DOWNLOAD"))) return 0;
+	hold h(*this);
+	*length = 0;
+	uint32_t window = 3000;
+	sim800_deadline deadline(window + SIM800_SERIAL_TIMEOUT);// the HTTPDATA window and its OK
+	unsigned short int status = HTTP_post_begin(url, size, window, _content_type ? _content_type : "application/x-www-form-urlencoded");
+	if (status) return status;
 #ifdef DEBUG_PACKETS
 	PRINT("~~~ '");
 	DEBUG(buffer);
 	PRINTLN("'");
 #endif
-	_serial.write((const uint8_t*)buffer, size);
-	if (!expect_OK(5000)) return 1005;
-	if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1004;
-	uint16_t status;
-	while (!expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, &length, 5000));// wait for the action to be completed, give it 5s for each try
-	return status;
+	write((const uint8_t*)buffer, size);
+	return HTTP_post_end(*length, deadline);
 }
 
-
 unsigned short int sim800::HTTP_post(const char *url, unsigned long int &length, STREAM &file, uint32_t size)
 {
-	expect_AT_OK(F("+HTTPTERM"));
-	vTaskDelay(100 / portTICK_RATE_MS);
-	if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-	if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-	// if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1\""))) return 1102;
-	// if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return 1103;
-	println_param("AT+HTTPPARA=\"URL\"", url);
-	if (!expect_OK()) return 1110;
-	print(F("AT+HTTPDATA="));
-	print(size);
-	print(F(","));
-	println((uint32_t) 120000);
-	if (!expect(F("DOWNLOAD"))) return 0;
-	uint8_t *buffer = (uint8_t *) malloc(SIM800_BUFSIZE);
+	hold h(*this);
+	length = 0;
+	uint32_t window = 120000;
+	sim800_deadline deadline(window + SIM800_SERIAL_TIMEOUT);
+	unsigned short int status = HTTP_post_begin(url, size, window, _content_type);
+	if (status) return status;
+	uint8_t *buffer = (uint8_t *) acquire(SIM800_BUF_IO, SIM800_BUFSIZE);
+	if (!buffer) return 1006;
 	uint32_t pos = 0, r = 0;
 	do
 	{
@@ -443,8 +644,9 @@ unsigned short int sim800::HTTP_post(const char *url, unsigned long int &length,
 		{
 			int c = file.read();
 			if (c == -1) break;
-			_serial.write((uint8_t) c);
+			buffer[r] = (uint8_t) c;
 		}
+		write(buffer, r);
 
 		if (r < SIM800_BUFSIZE)
 		{
@@ -465,80 +667,361 @@ unsigned short int sim800::HTTP_post(const char *url, unsigned long int &length,
 		pos += r;
 	}
 	while(r == SIM800_BUFSIZE);
-	free(buffer);
+	release(SIM800_BUF_IO);
 	PRINTLN("");
-	if (!expect_OK(5000)) return 1005;
+	return HTTP_post_end(length, deadline);
+}
+
+// the encoder runs twice, once to size the body and once into the UART
+unsigned short int sim800::HTTP_post(const char *url, unsigned long int &length, sim800_encode_fn encode, void *arg)
+{
+	hold h(*this);
+	length = 0;
+	sim800_counter counter;
+	sim800_cbor sizing(counter);
+	encode(sizing, arg);
+	uint32_t window = 120000;
+	sim800_deadline deadline(window + SIM800_SERIAL_TIMEOUT);
+	unsigned short int status = HTTP_post_begin(url, sizing.written, window, _content_type ? _content_type : SIM800_CBOR_CONTENT_TYPE);
+	if (status) return status;
+	sink out(*this, sizing.written);
+	sim800_cbor body(out);
+	encode(body, arg);
+	if (body.written != sizing.written)
+	{
+		// end DOWNLOAD with the announced size and drop the request
+		out.pad();
+		expect_OK(deadline.remaining());
+		expect_AT_OK(F("+HTTPTERM"));
+		return 1009;
+	}
+	return HTTP_post_end(length, deadline);
+}
+
+// everything up to the DOWNLOAD prompt, 0 when the modem waits for the body
+unsigned short int sim800::HTTP_post_begin(const char *url, uint32_t size, uint32_t time, const char *content)
+{
+	expect_AT_OK(F("+HTTPTERM"));
+	pause(100);
+	if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
+	if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
+	if (content)
+	{
+		println_param("AT+HTTPPARA=\"CONTENT\"", content);
+		if (!expect_OK()) return 1102;
+	}
+	println_param("AT+HTTPPARA=\"URL\"", url);
+	if (!expect_OK()) return 1110;
+	print(F("AT+HTTPDATA="));
+	print(size);
+	print(F(","));
+	println(time);
+	if (!expect(F("DOWNLOAD"))) return 1003;
+	return 0;
+}
+
+// the body is out, the modem says OK within the deadline of the post,
+// then run the action and wait for its result
+unsigned short int sim800::HTTP_post_end(unsigned long int &length, const sim800_deadline &deadline)
+{
+	if (!expect_OK(deadline.remaining())) return 1005;
 	if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1004;
 	uint16_t status;
-	while(!expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, &length, 5000));// wait for the action to be completed, give it 5s for each try
+	sim800_deadline action(SIM800_HTTP_TIMEOUT);
+	while (!expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, &length, action))// wait for the action to be completed
+	{
+		if (action.expired()) return 1007;
+	}
+	return status;
+}
+
+unsigned short int sim800::FTP_begin(const char *server, const char *user, const char *pass, unsigned short int port)
+{
+	if (!expect_AT_OK(F("+FTPCID=1"))) return 1000;
+	print(F("AT+FTPSERV=\""));
+	print(server);
+	println(F("\""));
+	if (!expect_OK()) return 1101;
+	print(F("AT+FTPPORT="));
+	println((uint32_t) port);
+	if (!expect_OK()) return 1102;
+	print(F("AT+FTPUN=\""));
+	print(user ? user : "anonymous");
+	println(F("\""));
+	if (!expect_OK()) return 1103;
+	if (pass)
+	{
+		print(F("AT+FTPPW=\""));
+		print(pass);
+		println(F("\""));
+		if (!expect_OK()) return 1104;
+	}
+	if (!expect_AT_OK(F("+FTPTYPE=\"I\""))) return 1105;
+	return 0;
+}
+
+// name, path and FTPGET=1 of a download, 0 once the session is open
+unsigned short int sim800::FTP_get_begin(const char *server, const char *path, const char *name, const char *user, const char *pass, unsigned short int port)
+{
+	unsigned short int status = FTP_begin(server, user, pass, port);
+	if (status) return status;
+	print(F("AT+FTPGETNAME=\""));
+	print(name);
+	println(F("\""));
+	if (!expect_OK()) return 1110;
+	print(F("AT+FTPGETPATH=\""));
+	print(path);
+	println(F("\""));
+	if (!expect_OK()) return 1111;
+	urc_pending &= ~(1UL << URC_FTPGET);
+	if (!expect_AT_OK(F("+FTPGET=1"))) return 1004;
+	return 0;
+}
+
+unsigned short int sim800::FTP_get(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, const char *user, const char *pass, unsigned short int port)
+{
+	hold h(*this);
+	length = 0;
+	unsigned short int status = FTP_get_begin(server, path, name, user, pass, port);
+	if (!status) status = FTP_receive(&file, 0, length);
+	if (status) expect_AT_OK(F("+FTPQUIT"));// the modem may still hold the session
+	return status;
+}
+
+unsigned short int sim800::FTP_get(const char *server, const char *path, const char *name, unsigned long int &length, esp_ota_handle_t ota_handle, const char *user, const char *pass, unsigned short int port)
+{
+	hold h(*this);
+	length = 0;
+	unsigned short int status = FTP_get_begin(server, path, name, user, pass, port);
+	if (!status) status = FTP_receive(NULL, ota_handle, length);
+	if (status) expect_AT_OK(F("+FTPQUIT"));
+	return status;
+}
+
+// drain the modem each time it reports data with +FTPGET: 1,1 until the
+// session reports +FTPGET: 1,0 (done) or an error code
+unsigned short int sim800::FTP_receive(STREAM *file, esp_ota_handle_t ota_handle, unsigned long int &length)
+{
+	char *buffer = (char *) acquire(SIM800_BUF_BULK, GSM_MAX_BUFFSIZE);
+	if (!buffer) return 1006;
+	unsigned short int status = 0;
+	while (true)
+	{
+		if (!wait_urc(URC_FTPGET, SIM800_CMD_TIMEOUT))
+		{
+			status = 1064;
+			break;
+		}
+		if (_ftp_code != 1)
+		{
+			status = _ftp_code;
+			break;
+		}
+		unsigned long int available;
+		do
+		{
+			print(F("AT+FTPGET=2,"));
+			println((uint32_t) GSM_MAX_BUFFSIZE);
+			available = 0;
+			if (!expect_scan(F("+FTPGET: 2,%lu"), &available))
+			{
+				status = 1005;
+				break;
+			}
+			size_t n = (size_t) min(available, (unsigned long int) GSM_MAX_BUFFSIZE);
+			size_t r = read(buffer, n, SIM800_SERIAL_TIMEOUT + line_ms(n));
+			if (!expect_OK())
+			{
+				status = 1005;
+				break;
+			}
+			if (file) file->write((const uint8_t *) buffer, r);
+			else if (esp_ota_write(ota_handle, (const void *) buffer, r) != ESP_OK)
+			{
+				status = 1007;
+				break;
+			}
+			length += r;
+		#ifdef DEBUG_PROGRESS
+			PRINT("<");
+		#endif
+		}
+		while (available);
+		if (status) break;
+	}
+#ifdef DEBUG_PACKETS
+	PRINT("~~~ FTP DONE: ");
+	DEBUGLN(length);
+#endif
+	release(SIM800_BUF_BULK);
+	return status;
+}
+
+unsigned short int sim800::FTP_put(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, uint32_t size, const char *user, const char *pass, unsigned short int port)
+{
+	hold h(*this);
+	length = 0;
+	unsigned short int status = FTP_send(server, path, name, length, file, size, user, pass, port);
+	if (status) expect_AT_OK(F("+FTPQUIT"));
 	return status;
 }
 
-inline size_t sim800::read(char *buffer, size_t length)
+unsigned short int sim800::FTP_send(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, uint32_t size, const char *user, const char *pass, unsigned short int port)
 {
+	unsigned short int status = FTP_begin(server, user, pass, port);
+	if (status) return status;
+	print(F("AT+FTPPUTNAME=\""));
+	print(name);
+	println(F("\""));
+	if (!expect_OK()) return 1110;
+	print(F("AT+FTPPUTPATH=\""));
+	print(path);
+	println(F("\""));
+	if (!expect_OK()) return 1111;
+	urc_pending &= ~(1UL << URC_FTPPUT);
+	if (!expect_AT_OK(F("+FTPPUT=1"))) return 1004;
+	uint8_t *buffer = (uint8_t *) acquire(SIM800_BUF_BULK, GSM_MAX_BUFFSIZE);
+	if (!buffer) return 1006;
+	bool closing = false;
+	while (true)
+	{
+		if (!wait_urc(URC_FTPPUT, SIM800_CMD_TIMEOUT))
+		{
+			status = 1064;
+			break;
+		}
+		if (_ftp_code != 1)
+		{
+			status = _ftp_code;
+			break;
+		}
+		if (closing) continue;
+		// the modem tells us how much it takes for the next chunk, no usable max is a full one
+		uint32_t limit = _ftp_max ? min(_ftp_max, (unsigned long int) GSM_MAX_BUFFSIZE) : GSM_MAX_BUFFSIZE;
+		uint32_t chunk = min(limit, size - length);
+		uint32_t r = 0;
+		for (; r < chunk; r++)
+		{
+			int c = file.read();
+			if (c == -1) break;
+			buffer[r] = (uint8_t) c;
+		}
+		sim800_deadline deadline(SIM800_CHUNK_TIMEOUT + line_ms(r));
+		print(F("AT+FTPPUT=2,"));
+		println(r);
+		if (!r)// end of data, close the session
+		{
+			closing = true;
+			if (!expect_OK())
+			{
+				status = 1005;
+				break;
+			}
+			continue;
+		}
+		unsigned long int accepted = 0;
+		if (!expect_scan(F("+FTPPUT: 2,%lu"), &accepted, deadline.remaining(SIM800_SERIAL_TIMEOUT)) || accepted != r)
+		{
+			status = 1005;
+			break;
+		}
+		write(buffer, r);
+		if (!expect_OK(deadline.remaining()))
+		{
+			status = 1005;
+			break;
+		}
+		length += r;
+	#ifdef DEBUG_PROGRESS
+		PRINT(">");
+	#endif
+	}
+	release(SIM800_BUF_BULK);
+	if (!status && length != size) return 1011;// the source ended early
+	return status;
+}
+
+// UART time of bytes at the current rate, 10 bits each
+uint32_t sim800::line_ms(size_t bytes)
+{
+	return (uint32_t) ((uint64_t) bytes * 10000 / _serialSpeed) + 1;
+}
+
+size_t sim800::read(char *buffer, size_t length, const sim800_deadline &deadline)
+{
+	hold h(*this);
 	uint32_t idx = 0;
 	while(length)
 	{
 		while(length && _serial.available())
 		{
 			buffer[idx++] = (char)_serial.read();
+			TRACE(SIM800_TRACE_RX, buffer + idx - 1, 1);
 			length--;
+			_stats.bytes_in++;
 		}
+		if(!length || deadline.expired()) break;
+		pause(1);
 	}
 	return idx;
 }
 
-inline size_t sim800::read_ota(size_t length, esp_ota_handle_t ota_handle)
+// copy from the UART into the OTA partition in OTA_BUFFSIZE blocks
+size_t sim800::read_ota(esp_ota_handle_t ota_handle, size_t length, const sim800_deadline &deadline)
 {
-	esp_err_t err = -1;
+	hold h(*this);
+	esp_err_t err = ESP_OK;
 	size_t idx = 0, i = 0;
-	char* buffer = (char*)malloc(OTA_BUFFSIZE);
-	if(buffer)
+	char* buffer = (char*) acquire(SIM800_BUF_OTA, OTA_BUFFSIZE);
+	if(!buffer) return 0;
+	while(length && err == ESP_OK)
 	{
-		memset(buffer, 0, OTA_BUFFSIZE);
-		while(length)
+		while(length && _serial.available())
 		{
-			while(length && _serial.available())
+			buffer[i++] = (char) _serial.read();
+			TRACE(SIM800_TRACE_RX, buffer + i - 1, 1);
+			idx++;
+			_stats.bytes_in++;
+			length--;
+			if(i == OTA_BUFFSIZE)
 			{
-				buffer[i++] = (char) _serial.read();
-				idx++;
-				length--;
-				if(i == OTA_BUFFSIZE)
-				{
-					i = 0;
-					err = esp_ota_write(ota_handle, (const void *)buffer, OTA_BUFFSIZE);
-					memset(buffer, 0, OTA_BUFFSIZE);
-					// ESP_ERROR_CHECK( err );
-					if(err != ESP_OK) break;
-				}
+				i = 0;
+				err = esp_ota_write(ota_handle, (const void *)buffer, OTA_BUFFSIZE);
+				if(err != ESP_OK) break;
 			}
-			 if(err != ESP_OK){idx = 0; break;}
 		}
-		free(buffer);
+		if(!length || err != ESP_OK || deadline.expired()) break;
+		pause(1);
 	}
+	if(err == ESP_OK && i) err = esp_ota_write(ota_handle, (const void *)buffer, i);
+	if(err != ESP_OK) idx = 0;
+	release(SIM800_BUF_OTA);
 	return idx;
 }
 
-bool sim800::connect(const char *address, unsigned short int port, uint16_t timeout)
+bool sim800::connect(const char *address, unsigned short int port, uint32_t timeout)
 {
+	hold h(*this);
+	sim800_deadline deadline(timeout);
 	if (!expect_AT(F("+CIPSHUT"), F("SHUT OK"))) return false;
 	if (!expect_AT_OK(F("+CMEE=2"))) return false;
 	if (!expect_AT_OK(F("+CIPQSEND=1"))) return false;
 	print(F("AT+CSTT=\""));// bring connection up, force it
-	print(_apn);
+	if (_apn) print(_apn);
 	println(F("\""));
 	if (!expect_OK()) return false;
 	if (!expect_AT_OK(F("+CIICR"))) return false;
 	bool connected;
-	do// try five times to get an IP address
+	uint8_t attempt = 0;
+	do// poll for an IP address until the deadline
 	{
-		char ipaddress[23];
+		char ipaddress[SIM800_BUFSIZE];
 		println(F("AT+CIFSR"));
-		expect_scan(F("%s"), ipaddress);
-		connected = strcmp_P(ipaddress, PSTR("ERROR")) != 0;
-		if(!connected) vTaskDelay(1 / portTICK_RATE_MS);
+		connected = expect_scan(F("%s"), ipaddress, deadline.remaining(answer_wait(SIM800_SERIAL_TIMEOUT)))
+			&& strcmp_P(ipaddress, PSTR("ERROR")) != 0;
+		if(!connected) pause(deadline.remaining(retry_after(attempt++, SIM800_POLL_INTERVAL)));
 	}
-	while(timeout-- && !connected);
+	while(!connected && !deadline.expired());
 	if(!connected) return false;
 	print(F("AT+CIPSTART=0,\"TCP\",\""));
 	print(address);
@@ -546,12 +1029,13 @@ bool sim800::connect(const char *address, unsigned short int port, uint16_t time
 	print(port);
 	println(F("\""));
 	if(!expect_OK()) return false;
-	if(!expect(F("0, CONNECT OK"), 30000)) return false;
+	if(!expect(F("0, CONNECT OK"), deadline)) return false;
 	return connected;
 }
 
 bool sim800::status()
 {
+	hold h(*this);
 	println(F("AT+CIPSTATUS=0"));
 	char status[SIM800_BUFSIZE];
 	expect_scan(F("+CIPSTATUS: %s"), status);
@@ -562,15 +1046,17 @@ bool sim800::status()
 
 bool sim800::disconnect()
 {
+	hold h(*this);
 	return expect_AT_OK(F("+CIPCLOSE=0"));
 }
 
 bool sim800::send(char *buffer, size_t size, unsigned long int &accepted)
 {
+	hold h(*this);
 	print(F("AT+CIPSEND=0,"));
 	println((uint32_t) size);
 	if(!expect(F("> "))) return false;
-	_serial.write((const uint8_t *) buffer, size);
+	write((const uint8_t *) buffer, size);
 	if(!expect_scan(F("DATA ACCEPT: 0,%lu"), &accepted, 3000))
 	{
 	// we have a buffer of 319488 bytes, so we are optimistic,
@@ -583,6 +1069,7 @@ bool sim800::send(char *buffer, size_t size, unsigned long int &accepted)
 
 size_t sim800::receive(char *buffer, size_t size)
 {
+	hold h(*this);
 	size_t actual = 0;
 	while(actual < size)
 	{
@@ -590,8 +1077,10 @@ size_t sim800::receive(char *buffer, size_t size)
 		print(F("AT+CIPRXGET=2,0,"));
 		println(chunk);
 		unsigned long int requested, confirmed;
-		if(!expect_scan(F("+CIPRXGET: 2,%*d,%lu,%lu"), &requested, &confirmed)) return 0;
-		actual += read(buffer, (size_t) confirmed);
+		if(!expect_scan(F("+CIPRXGET: 2,%*d,%lu,%lu"), &requested, &confirmed)) return actual;
+		actual += read(buffer + actual, (size_t) requested, SIM800_SERIAL_TIMEOUT + line_ms(requested));
+		expect_OK();
+		if(!confirmed) break;// nothing left in the modem buffer, do not block
 	}
 	return actual;
 }
@@ -601,184 +1090,480 @@ size_t sim800::receive(char *buffer, size_t size)
  * ===========================================================================
  */
 
-// read a line
-size_t sim800::readline(char *buffer, size_t max, uint16_t timeout)
+// read a line into buffer, which holds max characters plus the terminator;
+// the rest of a longer line is dropped
+size_t sim800::readline(char *buffer, size_t max, const sim800_deadline &deadline)
 {
-	uint16_t idx = 0;
-	while(--timeout)
+	hold h(*this);
+	size_t idx = 0;
+	bool line = false, garbled = false;
+	while(!line)
 	{
 		while(_serial.available())
 		{
 			char c = (char)_serial.read();
+			TRACE(SIM800_TRACE_RX, &c, 1);
+			_stats.bytes_in++;
 			if(c == '\r') continue;
 			if(c == '\n')
 			{
 				if (!idx) continue;
-				timeout = 0;
+				line = true;
 				break;
 			}
-			if(max - idx) buffer[idx++] = c;
+			if((c < 0x20 || c > 0x7e) && c != '\t') garbled = true;
+			if(idx < max) buffer[idx++] = c;
 		}
-		if(timeout == 0) break;
-		vTaskDelay(1 / portTICK_RATE_MS);
+		if(idx == 2 && buffer[0] == '>' && buffer[1] == ' ') break;// the data prompt has no line end
+		if(line || deadline.expired()) break;
+		pause(1);
 	}
 	buffer[idx] = 0;
+	// a wrong or unreliable rate shows up as bytes no AT response has
+	if(garbled)
+	{
+		if(_baud_errors < 0xff) _baud_errors++;
+	}
+	else if(idx) _baud_errors = 0;
+	if(idx > _memory[SIM800_BUF_LINE].high_water) _memory[SIM800_BUF_LINE].high_water = idx;
 	return idx;
 }
 
+// wait for a pin level, returns early as soon as it is reached
+bool sim800::wait_pin(uint8_t pin, int level, uint32_t timeout)
+{
+	sim800_deadline deadline(timeout);
+	while(digitalRead(pin) != level)
+	{
+		if(deadline.expired()) return false;
+		pause(SIM800_POLL_INTERVAL);
+	}
+	return true;
+}
+
+// hand out the arena buffer of a class, NULL if it is busy or too small
+void *sim800::acquire(uint8_t pool, size_t len)
+{
+	if(pool >= SIM800_BUF_POOLS) return NULL;
+	sim800_memory &m = _memory[pool];
+	if(m.in_use || len > m.size)
+	{
+		m.failed++;
+		return NULL;
+	}
+	m.in_use = true;
+	m.acquired++;
+	if(len > m.high_water) m.high_water = len;
+	switch(pool)
+	{
+		case SIM800_BUF_IO: return _buf_io;
+		case SIM800_BUF_OTA: return _buf_ota;
+		default: return _buf_bulk;
+	}
+}
+
+void sim800::release(uint8_t pool)
+{
+	_memory[pool].in_use = false;
+}
+
+void sim800::memory_report(sim800_memory report[SIM800_BUF_CLASSES])
+{
+	memcpy(report, _memory, sizeof(_memory));
+}
+
+size_t sim800::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = _serial.write(buffer, size);
+	TRACE(SIM800_TRACE_TX, buffer, n);
+	_stats.bytes_out += n;
+	return n;
+}
+
+void sim800::pause(uint32_t ms)
+{
+	_stats.delay_ms += ms;
+	vTaskDelay(ms / portTICK_RATE_MS);
+}
+
+// a command line starts, the previous command is done by now
+void sim800::command_begin()
+{
+	if(_baud_errors >= SIM800_BAUD_ERRORS && _serialSpeed > SIM800_BAUD)
+	{
+		_baud_errors = 0;// the commands below must not come back here
+		for(uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++)
+		{
+			if(_baud_rates[i] < _serialSpeed && set_baud(_baud_rates[i])) break;
+		}
+		if(session_valid && session.baud != _serialSpeed)
+		{
+			session.baud = _serialSpeed;
+			save_session();
+		}
+	}
+	if(_asleep) wake();// wake() clears _asleep before its own commands
+	command_end();
+	_cmd_open = true;
+	_cmd_head_len = 0;
+	_cmd_start = millis();
+	_cmd_last = 0;
+}
+
+static_assert(URC_COUNT <= SIM800_URC_SLOTS, "sim800_stats.urc too small");
+
+static const char * const _cmd_prefixes[SIM800_CMD_CLASSES] PROGMEM = {
+	"", "AT+CGATT", "AT+SAPBR", "AT+HTTPACTION", "AT+HTTPREAD", "AT+HTTPDATA",
+	"AT+CIPSEND", "AT+CIPRXGET", "AT+FTP", "AT+CREG"
+};
+
+// the command line is complete, classify it by its first characters
+void sim800::command_sent()
+{
+	_cmd_head[_cmd_head_len] = 0;
+	uint8_t cls = SIM800_CMD_OTHER;
+	for(uint8_t i = 1; i < SIM800_CMD_CLASSES; i++)
+	{
+		if(!strncmp(_cmd_head, _cmd_prefixes[i], strlen(_cmd_prefixes[i])))
+		{
+			cls = i;
+			break;
+		}
+	}
+	bool retry = cls == _cmd_class && _cmd_failed;
+	if(retry) _stats.cmd[cls].retries++;
+	_cmd_class = cls;
+	_cmd_failed = false;
+	_cmd_open = false;
+	_cmd_rtt = rtt_slot();
+	_cmd_answered = false;
+	_cmd_sample = !retry;// Karn: a retried command gives an ambiguous sample
+	_cmd_sent = millis();
+	_stats.cmd[cls].count++;
+	at_commands++;
+}
+
+// account the latency of the last command up to its last response line
+void sim800::command_end()
+{
+	if(!_cmd_start) return;
+	static const uint16_t limits[SIM800_LATENCY_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000};
+	sim800_cmd_stats &c = _stats.cmd[_cmd_class];
+	uint32_t ms = _cmd_last >= _cmd_start ? _cmd_last - _cmd_start : 0;
+	uint8_t bucket = 0;
+	while(bucket < SIM800_LATENCY_BUCKETS - 1 && ms >= limits[bucket]) bucket++;
+	if(c.latency[bucket] < 0xffff) c.latency[bucket]++;
+	c.total_ms += ms;
+	if(ms > c.max_ms) c.max_ms = ms;
+	_cmd_start = 0;
+}
+
+// find the estimator of the current command, taking over the least recently used one
+uint8_t sim800::rtt_slot()
+{
+	char key[SIM800_RTT_KEY + 1];
+	uint8_t len = 0, slot = 0;
+	while(len < SIM800_RTT_KEY && len < _cmd_head_len && _cmd_head[len] != '"')
+	{
+		key[len] = _cmd_head[len];
+		len++;
+	}
+	key[len] = 0;
+	uint32_t now = millis();
+	for(uint8_t i = 0; i < SIM800_RTT_SLOTS; i++)
+	{
+		if(!strcmp(_rtt[i].cmd, key))
+		{
+			_rtt[i].used = now;
+			return i;
+		}
+		if(!_rtt[i].cmd[0]) slot = i;// free slots go first
+		else if(_rtt[slot].cmd[0] && now - _rtt[i].used > now - _rtt[slot].used) slot = i;
+	}
+	memset(&_rtt[slot], 0, sizeof(sim800_rtt));
+	strcpy(_rtt[slot].cmd, key);
+	_rtt[slot].used = now;
+	return slot;
+}
+
+uint32_t sim800::rto(uint8_t slot, uint32_t cap)
+{
+	const sim800_rtt &r = _rtt[slot];
+	if(r.samples < SIM800_RTT_TRUST) return cap;
+	uint32_t rto = (r.srtt + 4 * r.rttvar) << r.backoff;
+	if(rto < SIM800_RTO_MIN) rto = SIM800_RTO_MIN;
+	return rto < cap ? rto : cap;
+}
+
+// how long an idempotent poll waits for the answer to the command just
+// sent: its rto once trusted, never more than cap; a late answer is only
+// read by the next poll of the same command
+uint32_t sim800::answer_wait(uint32_t cap)
+{
+	if(_cmd_rtt >= SIM800_RTT_SLOTS) return cap;
+	return rto(_cmd_rtt, cap);
+}
+
+// the pause before polling again after attempt tries: the rto of the last
+// command doubled per attempt, the fixed interval cap until it is trusted
+uint32_t sim800::retry_after(uint8_t attempt, uint32_t cap)
+{
+	if(_cmd_rtt >= SIM800_RTT_SLOTS || attempt >= 16) return cap;
+	uint32_t wait = rto(_cmd_rtt, cap) << attempt;
+	return wait < cap ? wait : cap;
+}
+
+void sim800::rtt_sample(uint8_t slot, uint32_t ms)
+{
+	sim800_rtt &r = _rtt[slot];
+	if(!r.samples)
+	{
+		r.srtt = ms;
+		r.rttvar = ms / 2;
+	}
+	else
+	{
+		uint32_t err = ms > r.srtt ? ms - r.srtt : r.srtt - ms;
+		r.rttvar = (3 * r.rttvar + err) / 4;
+		r.srtt = (7 * r.srtt + ms) / 8;
+	}
+	if(r.samples < 0xffff) r.samples++;
+	r.backoff = 0;
+}
+
+bool sim800::load_rtt()
+{
+	hold h(*this);
+	nvs_handle_t handle;
+	char key[16];
+	size_t len = sizeof(_rtt);
+	bool ok = false;
+	if(nvs_open(SIM800_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+	{
+		ok = nvs_get_blob(handle, nvs_key(key, "rtt"), _rtt, &len) == ESP_OK && len == sizeof(_rtt);
+		nvs_close(handle);
+	}
+	if(!ok) clear_rtt();
+	for(uint8_t i = 0; i < SIM800_RTT_SLOTS; i++)
+	{
+		_rtt[i].backoff = 0;
+		_rtt[i].used = 0;// stamps of an earlier boot
+	}
+	return ok;
+}
+
+bool sim800::save_rtt()
+{
+	hold h(*this);
+	nvs_handle_t handle;
+	char key[16];
+	if(nvs_open(SIM800_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return false;
+	bool ok = nvs_set_blob(handle, nvs_key(key, "rtt"), _rtt, sizeof(_rtt)) == ESP_OK && nvs_commit(handle) == ESP_OK;
+	nvs_close(handle);
+	return ok;
+}
+
+void sim800::clear_rtt()
+{
+	hold h(*this);
+	memset(_rtt, 0, sizeof(_rtt));
+	_cmd_rtt = SIM800_RTT_SLOTS;
+}
+
+void sim800::rtt_snapshot(sim800_rtt out[SIM800_RTT_SLOTS])
+{
+	hold h(*this);
+	memcpy(out, _rtt, sizeof(_rtt));
+}
+
+void sim800::stats_snapshot(sim800_stats &out)
+{
+	hold h(*this);
+	memcpy(&out, &_stats, sizeof(_stats));
+}
+
+void sim800::stats_reset()
+{
+	hold h(*this);
+	memset(&_stats, 0, sizeof(_stats));
+}
+
 void sim800::eat_echo()
 {
 	while (_serial.available())
 	{
-		_serial.read();
+		char c = (char)_serial.read();
+		TRACE(SIM800_TRACE_RX, &c, 1);
+		_stats.bytes_in++;
 		// don't be too quick or we might not have anything available
 		// when there actually is...
-		vTaskDelay(1 / portTICK_RATE_MS);
+		pause(1);
 	}
 }
 
 void sim800::print(const __FlashStringHelper *s)
 {
+	hold h(*this);
 #ifdef DEBUG_AT
 	PRINT("+++ ");
 	DEBUGQLN(s);
 #endif
-	_serial.print(s);
+	if(!_cmd_open) command_begin();
+	for(const char *c = s; *c && _cmd_head_len < sizeof(_cmd_head) - 1; c++) _cmd_head[_cmd_head_len++] = *c;
+	TRACE(SIM800_TRACE_TX, s, strlen(s));
+	_stats.bytes_out += _serial.print(s);
 }
 
 void sim800::print(uint32_t s)
 {
+	hold h(*this);
 #ifdef DEBUG_AT
 	PRINT("+++ ");
 	DEBUGLN(s);
 #endif
-	_serial.print(s);
+	if(!_cmd_open) command_begin();
+#ifdef SIM800_TRACE
+	char num[11];
+	TRACE(SIM800_TRACE_TX, num, snprintf(num, sizeof(num), "%lu", (unsigned long) s));
+#endif
+	_stats.bytes_out += _serial.print(s);
 }
 
-
 void sim800::println(const __FlashStringHelper *s)
 {
-#ifdef DEBUG_AT
-	PRINT("+++ ");
-	DEBUGQLN(s);
-#endif
-	_serial.print(s);
+	hold h(*this);
+	print(s);
 	eat_echo();
-	_serial.println();
+	TRACE(SIM800_TRACE_TX, "\r\n", 2);
+	_stats.bytes_out += _serial.println();
+	command_sent();
 }
 
 void sim800::println(uint32_t s)
 {
-#ifdef DEBUG_AT
-	PRINT("+++ ");
-	DEBUGLN(s);
-#endif
-	_serial.print(s);
+	hold h(*this);
+	print(s);
 	eat_echo();
-	_serial.println();
+	TRACE(SIM800_TRACE_TX, "\r\n", 2);
+	_stats.bytes_out += _serial.println();
+	command_sent();
 }
 
-bool sim800::expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected, uint16_t timeout)
+bool sim800::expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected, sim800_deadline deadline)
 {
+	hold h(*this);
 	print(F("AT"));
 	println(cmd);
-	vTaskDelay(10 / portTICK_RATE_MS);
-	return expect(expected, timeout);
+	pause(10);
+	return expect(expected, deadline);
 }
 
-bool sim800::expect_AT_OK(const __FlashStringHelper *cmd, uint16_t timeout)
+bool sim800::expect_AT_OK(const __FlashStringHelper *cmd, sim800_deadline deadline)
 {
-	return expect_AT(cmd, F("OK"), timeout);
+	hold h(*this);
+	return expect_AT(cmd, F("OK"), deadline);
 }
 
-bool sim800::expect(const __FlashStringHelper *expected, uint16_t timeout)
+// read the next line that is not a URC, skipped URCs count against the deadline;
+// the first answer to a command feeds its estimator, see rto()
+size_t sim800::expect_line(char *buf, const sim800_deadline &deadline)
 {
-	char buf[SIM800_BUFSIZE];
 	size_t len, i=0;
-	do{len = readline(buf, SIM800_BUFSIZE, timeout); i++; if(i>5)break;} while(is_urc(buf, len));
+	bool first = !_cmd_answered && _cmd_rtt < SIM800_RTT_SLOTS;
+	do{len = readline(buf, SIM800_BUFSIZE - 1, deadline); i++; if(i>5)break;} while(is_urc(buf, len));
 #ifdef DEBUG_AT
 	PRINT("--- (");
 	DEBUG(len);
 	PRINT(") ");
 	DEBUGQLN(buf);
 #endif
+	_cmd_last = millis();
+	if(first)
+	{
+		_cmd_answered = true;
+		if(len && _cmd_sample) rtt_sample(_cmd_rtt, _cmd_last - _cmd_sent);
+		else if(!len && _rtt[_cmd_rtt].backoff < SIM800_RTO_BACKOFF) _rtt[_cmd_rtt].backoff++;
+	}
+	if(!len)
+	{
+		_stats.cmd[_cmd_class].timeouts++;
+		_cmd_failed = true;
+	}
+	return len;
+}
+
+bool sim800::expect(const __FlashStringHelper *expected, sim800_deadline deadline)
+{
+	hold h(*this);
+	char buf[SIM800_BUFSIZE];
+	expect_line(buf, deadline);
 	_serial.flush();
-	return strcmp_P(buf, (const char PROGMEM *) expected) == 0;
+	bool ok = strcmp_P(buf, (const char PROGMEM *) expected) == 0;
+	if(!ok) _cmd_failed = true;
+	return ok;
 }
 
-bool sim800::expect_OK(uint16_t timeout)
+bool sim800::expect_OK(sim800_deadline deadline)
 {
-	return expect(F("OK"), timeout);
+	hold h(*this);
+	return expect(F("OK"), deadline);
 }
 
-bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, uint16_t timeout)
+bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, sim800_deadline deadline)
 {
+	hold h(*this);
 	char buf[SIM800_BUFSIZE];
-	size_t len, i=0;
-	do{len = readline(buf, SIM800_BUFSIZE, timeout); i++; if(i>5)break;} while(is_urc(buf, len));
-#ifdef DEBUG_AT
-	PRINT("--- (");
-	DEBUG(len);
-	PRINT(") ");
-	DEBUGQLN(buf);
-#endif
-	return sscanf_P(buf, (const char PROGMEM *)pattern, ref) == 1;
+	expect_line(buf, deadline);
+	bool ok = sscanf_P(buf, (const char PROGMEM *)pattern, ref) == 1;
+	if(!ok) _cmd_failed = true;
+	return ok;
 }
 
-bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, uint16_t timeout)
+bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, sim800_deadline deadline)
 {
+	hold h(*this);
 	char buf[SIM800_BUFSIZE];
-	size_t len, i=0;
-	do{len = readline(buf, SIM800_BUFSIZE, timeout); i++; if(i>5)break;} while(is_urc(buf, len));
-#ifdef DEBUG_AT
-	PRINT("--- (");
-	DEBUG(len);
-	PRINT(") ");
-	DEBUGQLN(buf);
-#endif
-	return sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1) == 2;
+	expect_line(buf, deadline);
+	bool ok = sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1) == 2;
+	if(!ok) _cmd_failed = true;
+	return ok;
 }
 
-bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, void *ref3, uint16_t timeout)
+bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, void *ref3, sim800_deadline deadline)
 {
+	hold h(*this);
 	char buf[SIM800_BUFSIZE];
-	size_t len, i=0;
-	do{len = readline(buf, SIM800_BUFSIZE, timeout); i++; if(i>5)break;} while(is_urc(buf, len));
-#ifdef DEBUG_AT
-	PRINT("--- (");
-	DEBUG(len);
-	PRINT(") ");
-	DEBUGQLN(buf);
-#endif
-	return sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1, ref2, ref3) == 4;
+	expect_line(buf, deadline);
+	bool ok = sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1, ref2, ref3) == 4;
+	if(!ok) _cmd_failed = true;
+	return ok;
 }
 
-bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, uint16_t timeout)
+bool sim800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, sim800_deadline deadline)
 {
+	hold h(*this);
 	char buf[SIM800_BUFSIZE];
-	size_t len, i=0;
-	do{len = readline(buf, SIM800_BUFSIZE, timeout); i++; if(i>5)break;} while(is_urc(buf, len));
-#ifdef DEBUG_AT
-	PRINT("--- (");
-	DEBUG(len);
-	PRINT(") ");
-	DEBUGQLN(buf);
-#endif
-	return sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1, ref2) == 3;
+	expect_line(buf, deadline);
+	bool ok = sscanf_P(buf, (const char PROGMEM *)pattern, ref, ref1, ref2) == 3;
+	if(!ok) _cmd_failed = true;
+	return ok;
 }
 
 bool sim800::is_urc(const char *line, size_t len)
 {
 	urc_status = 0xff;
-	for(uint8_t i = 0; i < 17; i++)
+	if(!len) return false;
+	for(uint8_t i = 0; i < URC_COUNT; i++)
 	{
 	#ifdef __AVR__
 		const char *urc = (const char *) pgm_read_word(&(_urc_messages[i]));
 	#else
 		const char *urc = _urc_messages[i];
 	#endif
-		size_t urc_len = strlen(urc);
-		if(len >= urc_len && !strncmp(urc, line, urc_len))
+		if(*urc != *line) continue;// most lines fail on the first byte
+		size_t n = 1;
+		while(urc[n] && n < len && urc[n] == line[n]) n++;
+		if(!urc[n])
 		{
 		#ifdef DEBUG_URC
 			PRINT("!!! SIM800 URC(");
@@ -787,14 +1572,52 @@ bool sim800::is_urc(const char *line, size_t len)
 			DEBUGLN(urc);
 		#endif
 			urc_status = i;
+			_stats.urc[i]++;
+			handle_urc(i, line);
 			return true;
 		}
 	}
 	return false;
 }
 
+// remember URCs that arrive while we wait for something else
+void sim800::handle_urc(uint8_t urc, const char *line)
+{
+	urc_pending |= (1UL << urc);
+	switch(urc)
+	{
+		case URC_FTPGET:
+			sscanf_P(line, PSTR("+FTPGET: 1,%d"), &_ftp_code);
+			break;
+		case URC_FTPPUT:
+			_ftp_max = 0;
+			sscanf_P(line, PSTR("+FTPPUT: 1,%d,%lu"), &_ftp_code, &_ftp_max);
+			break;
+		case URC_PSUTTZ:
+		case URC_CTZV:
+			status_urc(urc, line);
+			break;
+	}
+}
+
+// block on incoming lines until the given URC shows up
+bool sim800::wait_urc(uint8_t urc, uint32_t timeout)
+{
+	char buf[SIM800_BUFSIZE];
+	sim800_deadline deadline(timeout);
+	while(!(urc_pending & (1UL << urc)))
+	{
+		if(deadline.expired()) return false;
+		size_t len = readline(buf, SIM800_BUFSIZE - 1, deadline);
+		if(len) is_urc(buf, len);
+	}
+	urc_pending &= ~(1UL << urc);
+	return true;
+}
+
 bool sim800::check_sim_card()
 {
+	hold h(*this);
 	#ifdef DEBUG_URC
 		PRINTLN("!!! SIM800 check SIM card inserted...");
 	#endif
@@ -806,10 +1629,11 @@ bool sim800::check_sim_card()
 
 int sim800::get_signal(int& ber)
 {
+	hold h(*this);
 	int rssi = 0;
 	println("AT+CSQ");
-	vTaskDelay(3000 / portTICK_RATE_MS);
-	expect_scan(F("+CSQ: %2d"), (void*)&rssi, (void*)ber);
+	expect_scan(F("+CSQ: %2d,%d"), (void*)&rssi, (void*)&ber);
+	expect_OK();
 #ifdef DEBUG_URC
 	PRINT("!!! SIM800 RSSI ");DEBUG(rssi);PRINTLN(" dBm");
 	PRINT("!!! SIM800 BER ");DEBUG(ber);PRINTLN(" %");
@@ -817,87 +1641,252 @@ int sim800::get_signal(int& ber)
 	return rssi;
 }
 
+// +CPIN: READY is on the URC list, so the answer to AT+CPIN? ends up in
+// urc_pending, no matter if it was sent at boot or as a reply
+bool sim800::sim_ready(uint32_t timeout)
+{
+	hold h(*this);
+	sim800_deadline deadline(timeout);
+	uint8_t attempt = 0;
+	do
+	{
+		if(urc_pending & (1UL << URC_CPIN_READY)) return true;
+		println(F("AT+CPIN?"));
+		expect_OK();
+		if(urc_pending & (1UL << URC_CPIN_READY)) return true;
+		pause(deadline.remaining(retry_after(attempt++, SIM800_POLL_INTERVAL * 5)));
+	}
+	while(!deadline.expired());
+	return false;
+}
+
+// a boot sends Call Ready and SMS Ready again, see wait_booted()
+void sim800::booting()
+{
+	urc_pending &= ~((1UL << URC_CALL_READY) | (1UL << URC_SMS_READY));
+	_booted = true;
+}
+
+// the call and SMS stacks come up seconds after RDY, commands sent
+// before that may fail
+void sim800::wait_booted()
+{
+	if(!_booted) return;
+	sim800_deadline deadline(SIM800_BOOT_TIMEOUT);
+	wait_urc(URC_CALL_READY, deadline.remaining());
+	wait_urc(URC_SMS_READY, deadline.remaining());
+	_booted = false;
+}
+
+// probe with AT until the modem answers instead of sleeping a fixed time
+bool sim800::wait_ready(uint32_t timeout)
+{
+	hold h(*this);
+	sim800_deadline deadline(timeout);
+	uint8_t attempt = 0;
+	do
+	{
+		if(expect_AT_OK(F(""), deadline.remaining(retry_after(attempt++, SIM800_POLL_INTERVAL)))) return true;
+	}
+	while(!deadline.expired());
+	return false;
+}
+
+// look up the APN by the numeric operator id, a table set with
+// setAPNTable() takes precedence over the built-in one
 void sim800::set_operator()
 {
-	int operator_index = -1;
-	char* operator_name = (char*)malloc(64);
-	if(operator_name)
+	hold h(*this);
+	char plmn[SIM800_BUFSIZE] = {0};
+	expect_AT_OK(F("+COPS=3,2"));// numeric operator format
+	println(F("AT+COPS?"));
+	if(!expect_scan(F("+COPS: %*d,%*d,\"%7[0-9]\""), plmn, 3000)) return;
+	expect_OK();
+#if GSM_DEBUG
+	printf("\nGSM: AT RESPONSE: [%s]", plmn);
+#endif
+	uint32_t id = apn_plmn(plmn);
+	const sim800_apn *entry = NULL;
+	if(_apn_table) entry = apn_lookup(id, _apn_table, _apn_table_len);
+	if(!entry) entry = apn_lookup(id);
+	if(entry && id != current_operator)
 	{
-		memset(operator_name, 0, 64);
-		println(F("AT+COPS?"));
-		if(expect_scan(F("%s"), operator_name, 3000))
-		{
-			#if GSM_DEBUG
-			printf("\nGSM: AT RESPONSE: [%s]", operator_name);
-			#endif
-			for(int i = 0; i < 4; ++i)
-			{
-				if(strstr(operator_name, operators[i]))
-				{
-					operator_index = i;
-					break;
-				}
-			}
-		}
-		free(operator_name);
+		current_operator = id;
+		setAPN(entry->apn, entry->user, entry->pass);
+	}
+}
+
+// every modem keeps its own NVS entries, the default UART keeps the plain names
+const char *sim800::nvs_key(char *key, const char *name)
+{
+	if(_board.uart == SIM800_UART) return name;
+	snprintf(key, 16, "%s%u", name, _board.uart);
+	return key;
+}
+
+// the session cache lets a warm boot skip operator detection and bearer
+// setup, it is dropped as soon as a different SIM card shows up
+bool sim800::load_session()
+{
+	nvs_handle_t handle;
+	char key[16];
+	size_t len = sizeof(session);
+	session_valid = false;
+	if(nvs_open(SIM800_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+	{
+		clear_session();
+		return false;
 	}
-	if(operator_index > -1 && operator_index != current_operator)
+	if(nvs_get_blob(handle, nvs_key(key, "session"), &session, &len) == ESP_OK && len == sizeof(session) && session.version == SIM800_SESSION_VERSION)
 	{
-		current_operator = operator_index;
-		setAPN(apns[current_operator], users[current_operator], pwds[current_operator]);
+		session_valid = true;
 	}
+	nvs_close(handle);
+	if(!session_valid) clear_session();
+#ifdef DEBUG_PROGRESS
+	PRINT("!!! SIM800 session ");DEBUGLN(session_valid ? session.imsi : "none");
+#endif
+	return session_valid;
+}
+
+bool sim800::save_session()
+{
+	nvs_handle_t handle;
+	char key[16];
+	session.version = SIM800_SESSION_VERSION;
+	if(current_operator) snprintf(session.op, sizeof(session.op), "%lu", (unsigned long) current_operator);
+	if(_apn && _apn != session.apn) strncpy(session.apn, _apn, sizeof(session.apn) - 1);
+	if(_user && _user != session.user) strncpy(session.user, _user, sizeof(session.user) - 1);
+	if(_pass && _pass != session.pass) strncpy(session.pass, _pass, sizeof(session.pass) - 1);
+	if(nvs_open(SIM800_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) return false;
+	bool ok = nvs_set_blob(handle, nvs_key(key, "session"), &session, sizeof(session)) == ESP_OK && nvs_commit(handle) == ESP_OK;
+	nvs_close(handle);
+	session_valid = ok;
+	return ok;
+}
+
+void sim800::clear_session()
+{
+	memset(&session, 0, sizeof(session));
+	session_valid = false;
 }
 
 bool sim800::gsm_init()
 {
+	hold h(*this);
 	uint16_t ip0=0, ip1=0, ip2=0, ip3=0;
+	uint32_t start = millis();
+	memset(&bringup_time, 0, sizeof(bringup_time));
+	urc_pending &= (1UL << URC_CALL_READY) | (1UL << URC_SMS_READY);// of a boot under way
+	bool warm = load_session();
+	load_rtt();
+	if(warm && session.baud) _serialSpeed = session.baud;
 	begin();
 	while(!wakeup())
 	{
-		vTaskDelay(3000 / portTICK_RATE_MS);
+		if(_serialSpeed != SIM800_BAUD)// the modem may have forgotten the rate
+		{
+			_serialSpeed = SIM800_BAUD;
+			begin();
+		}
+		pause(SIM800_POLL_INTERVAL);
 	}
-	expect_AT_OK(F(""));
-	expect_AT_OK(F("+CSCLK=0"));//disable sleep mode
+	bringup_time.at_ms = millis() - start;
+	wait_booted();
+	_asleep = false;
+	_sleep_mode = 0;
+	expect_AT_OK(F("+CSCLK=0"));//disable sleep mode, see sleep()
 	expect_AT_OK(F("+CNMI=0,0,0,0,0"));//disable incoming SMS
 	expect_AT_OK(F("+GSMBUSY=1"));//disable incoming calls
 	expect_AT_OK(F("+CBC"), 2000);//power monitor
 	expect_AT_OK(F("+CADC?"), 2000);//acp monitor
-	if(!check_sim_card())
+	if(_board.rts >= 0 && _board.cts >= 0) flow_control(true);
+	if(SIM800_BAUD_MAX > _serialSpeed) negotiate_baud();
+	for(uint8_t n = 0; !sim_ready(); n++)
 	{
-		vTaskDelay(3000 / portTICK_RATE_MS);
-		while(!check_sim_card()) vTaskDelay(60000 / portTICK_RATE_MS);
+		if(n == SIM800_INIT_ATTEMPTS || !check_sim_card()) return false;
+		pause(backoff(n));
 	}
-	gsm_rssi = get_signal(gsm_ber);
-	while(gsm_rssi < 1 || gsm_rssi > 98)
+	bringup_time.sim_ms = millis() - start;
+	char imsi[sizeof(session.imsi)] = {0};// CIMI() scans at most 15 digits
+	CIMI(imsi);
+	if(warm && strcmp(imsi, session.imsi))
 	{
-		vTaskDelay(10000 / portTICK_RATE_MS);
-		gsm_rssi = get_signal(gsm_ber);
+	#ifdef DEBUG_PROGRESS
+		PRINTLN("!!! SIM800 SIM changed, cold start");
+	#endif
+		clear_session();
+		warm = false;
 	}
-	while(!registerNetwork())
+	for(uint8_t n = 0; !registerNetwork(); n++)
 	{
-		vTaskDelay(20000 / portTICK_RATE_MS);
-		shutdown();
-		wakeup();
+		if(n == SIM800_INIT_ATTEMPTS) return false;
+		if(n == 0) radio_reset();// cheaper than a reboot, try it first
+		else
+		{
+			shutdown();
+			wakeup();
+			wait_booted();
+		}
+		pause(backoff(n));
 	}
+	bringup_time.registered_ms = millis() - start;
+	gsm_rssi = get_signal(gsm_ber);
 	println(F("AT+CGATT?"));
 	expect(F("+CGATT: "), 3000);
-	set_operator();
-	println(F("AT+SAPBR=1,1"));
-	expect_OK();
-	println(F("AT+SAPBR=2,1"));
-	vTaskDelay(2000 / portTICK_RATE_MS);
-	bool result = expect_scan(F("+SAPBR: 1,1,\"%d.%d.%d.%d\""), &ip0, &ip1, &ip2, &ip3);
-	if(ip0==0 && ip1==0 && ip2==0 && ip3==0){println(F("AT+SAPBR=2,1"));vTaskDelay(2000/portTICK_RATE_MS);result=expect_OK();}
+	if(warm)// the modem still has the bearer profile saved with SAPBR=5,1
+	{
+		current_operator = strtoul(session.op, NULL, 10);
+		setAPN(session.apn[0] ? session.apn : NULL, session.user[0] ? session.user : NULL, session.pass[0] ? session.pass : NULL);
+	}
+	else
+	{
+		set_operator();
+		if(set_bearer()) expect_AT_OK(F("+SAPBR=5,1"));
+	}
+	expect_AT_OK(F("+SAPBR=1,1"), SIM800_CMD_TIMEOUT);
+	bool result = false;
+	uint8_t attempt = 0;
+	sim800_deadline bearer(SIM800_BOOT_TIMEOUT);
+	do
+	{
+		println(F("AT+SAPBR=2,1"));
+		result = expect_scan(F("+SAPBR: 1,1,\"%hu.%hu.%hu.%hu\""), &ip0, &ip1, &ip2, &ip3, bearer.remaining(answer_wait(SIM800_SERIAL_TIMEOUT))) && expect_OK();
+		if(result && (ip0 || ip1 || ip2 || ip3)) break;
+		result = false;
+		pause(bearer.remaining(retry_after(attempt++, SIM800_POLL_INTERVAL)));
+	}
+	while(!bearer.expired());
+	if(result)
+	{
+		bringup_time.ip_ms = millis() - start;
+		save_rtt();
+		if(!warm || session.baud != _serialSpeed)
+		{
+			session.baud = _serialSpeed;
+			strcpy(session.imsi, imsi);
+			char imei[sizeof(session.imei)];// IMEI() answers from the session while it is valid
+			if(IMEI(imei) && strcmp(imei, session.imei)) strcpy(session.imei, imei);
+			save_session();
+		}
+	}
+#ifdef DEBUG_PROGRESS
+	PRINT("!!! SIM800 AT ");DEBUG(bringup_time.at_ms);
+	PRINT(" SIM ");DEBUG(bringup_time.sim_ms);
+	PRINT(" REG ");DEBUG(bringup_time.registered_ms);
+	PRINT(" IP ");DEBUGLN(bringup_time.ip_ms);
+#endif
 	return result;
 }
 
 void sim800::update_esp(String url_update)
 {
+	hold h(*this);
 	unsigned long int len = 0;
 	Serial.println("==== START UPDATE ====");
 	Serial.println(url_update);
 	uint16_t stat = HTTP_get(url_update.c_str(), &len);
-	vTaskDelay(3000/portTICK_RATE_MS);
+	pause(3000);
 	Serial.print("UPDATE HTTP status = ");Serial.print(stat);Serial.print("; received length = ");Serial.println(len);
 	if(stat > 200)
 	{
@@ -907,68 +1896,67 @@ void sim800::update_esp(String url_update)
 	}
 	else// else if(stat == 37 || stat == 200)
 	{
-		char* buffer = (char*)malloc(16);
-		if(buffer)
+		char buffer[17] = {0};
+		size_t result_read = HTTP_read(buffer, 0, 16);
+		if(result_read == (size_t) -1) return;
+		Serial.print("UPDATE HTTP read = ");Serial.print(buffer);Serial.print("; received length = ");Serial.println(result_read);
+		if(result_read > 0)
 		{
-			memset(buffer, 0, 16);
-			size_t result_read = HTTP_read(buffer, 0, 16);
-			if(result_read == -1)
+			// url_update = String(WEB_URL_API) + "/upgrade/" + String(buffer);
+			link_sample();
+			if(!link_bulk_ok(_ota_deferred ? millis() - _ota_deferred : 0))
 			{
-				free(buffer);
+				if(!_ota_deferred) _ota_deferred = millis() | 1;
+				Serial.println("UPDATE deferred, weak signal");
 				return;
 			}
-			Serial.print("UPDATE HTTP read = ");Serial.print(buffer);Serial.print("; received length = ");Serial.println(result_read);
-			if(result_read > 0)
+			_ota_deferred = 0;
+			Serial.println("Begin OTA. This may take 2 - 5 mins to complete. Things might be quite for a while.. Patience!");
+			unsigned short int status = HTTP_get(url_update.c_str(), &len);
+			if(status < 201)// if (len > 0)
 			{
-				// url_update = String(WEB_URL_API) + "/upgrade/" + String(buffer);
-				Serial.println("Begin OTA. This may take 2 - 5 mins to complete. Things might be quite for a while.. Patience!");
-				unsigned short int status = HTTP_get(url_update.c_str(), &len);
-				if(status < 201)// if (len > 0)
+				esp_err_t err;
+				esp_ota_handle_t update_handle = 0;/* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
+				const esp_partition_t *update_partition = NULL;
+				printf("Starting OTA example...\n");
+				const esp_partition_t *configured = esp_ota_get_boot_partition();
+				const esp_partition_t *running = esp_ota_get_running_partition();
+				if(configured != running)
 				{
-					esp_err_t err;
-					esp_ota_handle_t update_handle = 0;/* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-					const esp_partition_t *update_partition = NULL;
-					printf("Starting OTA example...\n");
-					const esp_partition_t *configured = esp_ota_get_boot_partition();
-					const esp_partition_t *running = esp_ota_get_running_partition();
-					if(configured != running)
-					{
-						printf("Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x\n", configured->address, running->address);
-						printf("(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)\n");
-					}
-					printf("Running partition type %d subtype %d (offset 0x%08x)\n", running->type, running->subtype, running->address);
-					update_partition = esp_ota_get_next_update_partition(NULL);
-					assert(update_partition != NULL);
-					printf("Writing to partition subtype %d at offset 0x%x\n", update_partition->subtype, update_partition->address);
-					err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-					if(err != ESP_OK)
-					{
-						printf("esp_ota_begin failed, error=%d\n", err);
-						return;
-					}
+					printf("Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x\n", configured->address, running->address);
+					printf("(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)\n");
+				}
+				printf("Running partition type %d subtype %d (offset 0x%08x)\n", running->type, running->subtype, running->address);
+				update_partition = esp_ota_get_next_update_partition(NULL);
+				assert(update_partition != NULL);
+				printf("Writing to partition subtype %d at offset 0x%x\n", update_partition->subtype, update_partition->address);
+				err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
+				if(err != ESP_OK)
+				{
+					printf("esp_ota_begin failed, error=%d\n", err);
+					return;
+				}
+				else
+				{
+					printf("esp_ota_begin succeeded\n");
+					uint32_t buff_len = 0;
+					size_t readed_ota_bytes = HTTP_read_ota(update_handle, buff_len, 512*1024);
+					printf("Total Write binary data length : %u\n", (unsigned) readed_ota_bytes);
+					if(esp_ota_end(update_handle) != ESP_OK)
+						printf("esp_ota_end failed!\n");
 					else
 					{
-						printf("esp_ota_begin succeeded\n");
-						uint32_t buff_len = 0;
-						size_t readed_ota_bytes = HTTP_read_ota(update_handle, buff_len, 512*1024);
-						printf("Total Write binary data length : %d\n", readed_ota_bytes);
-						if(esp_ota_end(update_handle) != ESP_OK)
-							printf("esp_ota_end failed!\n");
+						err = esp_ota_set_boot_partition(update_partition);
+						if(err != ESP_OK)
+							printf("esp_ota_set_boot_partition failed! err=0x%x\n", err);
 						else
 						{
-							err = esp_ota_set_boot_partition(update_partition);
-							if(err != ESP_OK)
-								printf("esp_ota_set_boot_partition failed! err=0x%x\n", err);
-							else
-							{
-								printf("Prepare to restart system!\n");
-								esp_restart();
-							}
+							printf("Prepare to restart system!\n");
+							esp_restart();
 						}
 					}
 				}
 			}
-			free(buffer);
 		}
 	}
 }
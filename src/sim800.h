@@ -10,37 +10,357 @@
 /*debugging of send/receive progress (not very verbose)*/
 // #define DEBUG_PROGRESS
 
+/*buffer sizes, may be set per project with -D*/
+#ifndef OTA_BUFFSIZE
 #define OTA_BUFFSIZE 1024
+#endif
+#ifndef TEXT_BUFFSIZE
 #define TEXT_BUFFSIZE 1024
+#endif
+#ifndef GSM_MAX_BUFFSIZE
 #define GSM_MAX_BUFFSIZE 1460
+#endif
+#ifndef CRITICAL_BUFFER_HTTPREAD
 #define CRITICAL_BUFFER_HTTPREAD 102400
+#endif
 
 #define SIM800_CMD_TIMEOUT 30000
 #define SIM800_SERIAL_TIMEOUT 1000
+/*upper bound for an HTTP action to report its result*/
+#define SIM800_HTTP_TIMEOUT 120000
+/*a data chunk answer on top of the UART time of its bytes, see line_ms()*/
+#define SIM800_CHUNK_TIMEOUT 5000
+#ifndef SIM800_BUFSIZE
 #define SIM800_BUFSIZE 64
+#endif
+/*bring-up polls the modem in short steps up to these deadlines*/
+#define SIM800_POLL_INTERVAL 100
+#define SIM800_PWRKEY_TIMEOUT 3000
+#define SIM800_BOOT_TIMEOUT 10000
+#define SIM800_SIM_TIMEOUT 10000
+/*warm-start session cache, kept in NVS*/
+#define SIM800_NVS_NAMESPACE "sim800"
+#define SIM800_SESSION_VERSION 2
+/*status cache refresh*/
+#define SIM800_STATUS_PERIOD 1000
+#define SIM800_STATUS_STACK 4096
+#define SIM800_STATUS_SIGNAL        0
+#define SIM800_STATUS_BATTERY       1
+#define SIM800_STATUS_CLOCK         2
+#define SIM800_STATUS_REGISTRATION  3
+#define SIM800_STATUS_LOCATION      4
+/*buffer classes, the first three are carved out of a per instance arena*/
+#define SIM800_BUF_IO       0
+#define SIM800_BUF_OTA      1
+#define SIM800_BUF_BULK     2
+#define SIM800_BUF_LINE     3
+#define SIM800_BUF_POOLS    3
+#define SIM800_BUF_CLASSES  4
+/*AT command classes for the latency statistics, see stats_snapshot()*/
+#define SIM800_CMD_OTHER       0
+#define SIM800_CMD_CGATT       1
+#define SIM800_CMD_SAPBR       2
+#define SIM800_CMD_HTTPACTION  3
+#define SIM800_CMD_HTTPREAD    4
+#define SIM800_CMD_HTTPDATA    5
+#define SIM800_CMD_CIPSEND     6
+#define SIM800_CMD_CIPRXGET    7
+#define SIM800_CMD_FTP         8
+#define SIM800_CMD_CREG        9
+#define SIM800_CMD_CLASSES     10
+/*latency buckets: <50, <100, <250, <500, <1000, <2500, <5000, <10000, <30000, more ms*/
+#define SIM800_LATENCY_BUCKETS 10
+#define SIM800_URC_SLOTS 20
+/*adaptive response timeouts, learned per command line prefix*/
+#define SIM800_RTT_SLOTS 16
+#define SIM800_RTT_KEY 12
+#define SIM800_RTT_TRUST 4
+#define SIM800_RTO_MIN 250
+#define SIM800_RTO_BACKOFF 4
+/*recovery tiers, cheapest first, see recover()*/
+#define SIM800_TIER_BEARER 0
+#define SIM800_TIER_SAPBR  1
+#define SIM800_TIER_CGATT  2
+#define SIM800_TIER_CFUN   3
+#define SIM800_TIER_POWER  4
+#define SIM800_TIERS       5
+#define SIM800_RECOVERY_TIMEOUT 300000
+#define SIM800_BACKOFF_BASE 1000
+#define SIM800_BACKOFF_MAX 60000
+#define SIM800_HEALTH_LOW 50
+/*link quality bands by +CSQ rssi: below 10 (or unknown), 10..14, 15..19, 20 up*/
+#define SIM800_LINK_BANDS 4
+#define SIM800_LINK_PERIOD 5000
+/*bulk work waits for this band, but never longer than SIM800_LINK_DEFER_MAX*/
+#define SIM800_LINK_BULK_BAND 1
+#define SIM800_LINK_DEFER_MAX 600000
+/*sleep modes, AT+CSCLK=1 with DTR or AT+CSCLK=2 woken by AT, see sleep()*/
+#define SIM800_SLEEP_AUTO 0
+#define SIM800_SLEEP_DTR  1
+#define SIM800_SLEEP_AT   2
+#define SIM800_DTR_SETTLE 50
+#define SIM800_WAKE_TIMEOUT 1000
+/*gsm_init() gives up after this many SIM or registration retries*/
+#define SIM800_INIT_ATTEMPTS 5
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_ota_ops.h"
+#include "nvs.h"
+#include "sim800_apn.h"
+#include "sim800_trace.h"
+
+class sim800_cbor;
+class sim800_pipe;
+/*writes one request body, called once to size it and once to send it*/
+typedef void (*sim800_encode_fn)(sim800_cbor &cbor, void *arg);
 
 #include "driver/uart.h"
 #include "soc/uart_struct.h"
 #include <stdint.h>
+#include <Arduino.h>
 #include <Stream.h>
 // #include <Update.h>
 
 #define STREAM Stream
+/*the UART class, a concrete type keeps all I/O calls non-virtual*/
+#ifdef SIM800_REPLAY
+#define SIM800_SERIAL sim800_replay
+#endif
+#ifndef SIM800_SERIAL
+#define SIM800_SERIAL HardwareSerial
+#endif
 
+/*default pin map, see sim800_board*/
+#ifndef SIM800_BAUD
 #define SIM800_BAUD 115200
+#endif
+/*gsm_init() negotiates up to this rate with AT+IPR, SIM800_BAUD disables it*/
+#ifndef SIM800_BAUD_MAX
+#define SIM800_BAUD_MAX 460800
+#endif
+#define SIM800_BAUD_PROBES 5
+#define SIM800_BAUD_ERRORS 3
+#ifndef SIM800_UART
+#define SIM800_UART 1
+#endif
+#ifndef SIM800_RX
 #define SIM800_RX   16
+#endif
+#ifndef SIM800_TX
 #define SIM800_TX   17
+#endif
+#ifndef SIM800_RST
 #define SIM800_RST  6
+#endif
+#ifndef SIM800_KEY
 #define SIM800_KEY  21
+#endif
+#ifndef SIM800_PS
 #define SIM800_PS   27
+#endif
+/*RTS/CTS of the ESP32 side (RTS goes to the modem CTS), -1 if not wired*/
+#ifndef SIM800_RTS
+#define SIM800_RTS  -1
+#endif
+#ifndef SIM800_CTS
+#define SIM800_CTS  -1
+#endif
+/*RX FIFO level at which RTS stops the modem, and the driver RX buffer*/
+#ifndef SIM800_RTS_THRESHOLD
+#define SIM800_RTS_THRESHOLD 64
+#endif
+#ifndef SIM800_RX_BUFSIZE
+#define SIM800_RX_BUFSIZE 1024
+#endif
+/*DTR wakes the modem in SIM800_SLEEP_DTR, RI pulses on URCs, -1 if not wired*/
+#ifndef SIM800_DTR
+#define SIM800_DTR  -1
+#endif
+#ifndef SIM800_RI
+#define SIM800_RI   -1
+#endif
 #ifdef F
 #undef F
 #define F(s) (s)
 #endif
 #define __FlashStringHelper char
 
+/*UART and pins one modem is wired to, -1 if not wired; flow control needs
+rts and cts, sleep with DTR needs dtr*/
+struct sim800_board
+{
+	uint8_t uart;
+	int8_t rx;
+	int8_t tx;
+	int8_t key;
+	int8_t ps;
+	int8_t rts;
+	int8_t cts;
+	int8_t dtr;
+	int8_t ri;
+};
+
+#define SIM800_BOARD_DEFAULT {SIM800_UART, SIM800_RX, SIM800_TX, SIM800_KEY, SIM800_PS, SIM800_RTS, SIM800_CTS, SIM800_DTR, SIM800_RI}
+
+/*milliseconds from gsm_init() until each bring-up milestone, 0 if not reached*/
+struct sim800_bringup
+{
+	uint32_t at_ms;
+	uint32_t sim_ms;
+	uint32_t registered_ms;
+	uint32_t ip_ms;
+};
+
+/*what a cold boot learns about SIM, network and bearer, see load_session()*/
+struct sim800_session
+{
+	uint16_t version;
+	uint32_t baud;
+	char imei[16];
+	char imsi[16];
+	char op[24];
+	char apn[32];
+	char user[16];
+	char pass[16];
+};
+
+struct sim800_signal
+{
+	int rssi;
+	int ber;
+};
+
+struct sim800_battery
+{
+	uint16_t status;
+	uint16_t percent;
+	uint16_t voltage;
+};
+
+struct sim800_clock
+{
+	char date[9];//yy/MM/dd
+	char time[9];//hh:mm:ss
+	char tz[4];//quarter hours, +zz
+};
+
+struct sim800_registration
+{
+	uint16_t stat;
+};
+
+struct sim800_location
+{
+	char lon[12];
+	char lat[12];
+	char date[11];
+	char time[9];
+};
+
+/*usage of one buffer class, see memory_report()*/
+struct sim800_memory
+{
+	uint16_t size;
+	uint16_t high_water;
+	uint32_t acquired;
+	uint32_t failed;
+	bool in_use;
+};
+
+struct sim800_cmd_stats
+{
+	uint32_t count;
+	uint32_t timeouts;
+	uint32_t retries;
+	uint32_t total_ms;
+	uint32_t max_ms;
+	uint16_t latency[SIM800_LATENCY_BUCKETS];
+};
+
+struct sim800_stats
+{
+	sim800_cmd_stats cmd[SIM800_CMD_CLASSES];
+	uint32_t urc[SIM800_URC_SLOTS];
+	uint32_t bytes_in;
+	uint32_t bytes_out;
+	uint32_t delay_ms;
+	uint32_t goodput_bytes[SIM800_LINK_BANDS];
+	uint32_t goodput_ms[SIM800_LINK_BANDS];
+};
+
+/*time to the first response line of one command, RFC 6298 style, in ms*/
+struct sim800_rtt
+{
+	char cmd[SIM800_RTT_KEY + 1];
+	uint8_t backoff;
+	uint16_t samples;
+	uint32_t srtt;
+	uint32_t rttvar;
+	uint32_t used;// millis() of the last use, the oldest slot is taken over
+};
+
+/*what recover() tried and what worked, health is 0..100*/
+struct sim800_recovery
+{
+	uint32_t attempts[SIM800_TIERS];
+	uint32_t fixed[SIM800_TIERS];
+	uint32_t recoveries;
+	uint32_t failures;
+	uint32_t backoff_ms;
+	uint32_t last_ms;
+	uint8_t health;
+	uint8_t tier;
+};
+
+/*what sleep() and wake() cost, wake times run until the modem answers AT*/
+struct sim800_sleep_stats
+{
+	uint32_t sleeps;
+	uint32_t wakes;
+	uint32_t ri_wakes;
+	uint32_t failed;
+	uint32_t bearer_lost;
+	uint32_t last_wake_ms;
+	uint32_t max_wake_ms;
+	uint32_t total_wake_ms;
+	uint32_t asleep_ms;
+};
+
+/*
+* A time budget on the millis() clock. Built implicitly from a number of
+* milliseconds, so every timeout parameter takes either a plain budget or
+* a deadline shared by several steps of one operation.
+*/
+struct sim800_deadline
+{
+	uint32_t start;
+	uint32_t budget;
+
+	sim800_deadline(uint32_t ms) : start(millis()), budget(ms) {}
+	bool expired() const
+	{
+		return millis() - start >= budget;
+	}
+	/*what is left of the budget, at most max*/
+	uint32_t remaining(uint32_t max = UINT32_MAX) const
+	{
+		uint32_t elapsed = millis() - start;
+		uint32_t left = elapsed >= budget ? 0 : budget - elapsed;
+		return left < max ? left : max;
+	}
+};
+
+/*a status value written by one task and read lock-free by others*/
+template <typename T> struct sim800_cached
+{
+	volatile uint32_t seq;
+	uint32_t ttl;
+	volatile uint32_t updated;
+	T value;
+};
+
 class sim800
 {
 public:
@@ -48,24 +368,48 @@ public:
 	int gsm_rssi = 0;
 	int gsm_ber = 0;
 	uint8_t urc_status = 0xff;
+	uint32_t urc_pending = 0;
+	uint32_t at_commands = 0;//command lines sent, one per modem round trip
+	sim800_bringup bringup_time = {0, 0, 0, 0};
+	sim800_session session;
+	bool session_valid = false;
 
-	sim800();
+	sim800(const sim800_board &board = SIM800_BOARD_DEFAULT);
 	void begin();
+	/**
+	* Switches modem and UART to another rate with AT+IPR and confirms it
+	* with SIM800_BAUD_PROBES AT exchanges, restoring the old rate if any
+	* of them fails. negotiate_baud() tries the supported rates from
+	* SIM800_BAUD_MAX down and returns the one in use. After
+	* SIM800_BAUD_ERRORS garbled lines in a row the next command steps down
+	* one rate and the session cache is updated.
+	*/
+	bool set_baud(uint32_t baud);
+	uint32_t negotiate_baud();
+	/**
+	* RTS/CTS flow control, on when the board has both pins wired. The
+	* UART side is set up in begin(), gsm_init() turns on AT+IFC=2,2 and
+	* falls back to no flow control if the modem refuses it.
+	*/
+	bool flow_control(bool enable);
 	void setAPN(const __FlashStringHelper *apn, const __FlashStringHelper *user, const __FlashStringHelper *pass);
+	void setAPNTable(const sim800_apn *table, size_t len);
 	bool unlock(const __FlashStringHelper *pin);
 	bool reset(bool flag_reboot = false);
 	bool shutdown();
 	bool wakeup();
-	bool registerNetwork(uint16_t timeout = SIM800_CMD_TIMEOUT);
-	bool enableGPRS(uint16_t timeout = SIM800_CMD_TIMEOUT);
+	bool registerNetwork(uint32_t timeout = SIM800_CMD_TIMEOUT);
+	bool enableGPRS(uint32_t timeout = SIM800_CMD_TIMEOUT);
 	bool disableGPRS();
 	bool time(char *date, char *time, char *tz);
+	/*15 digits, the buffers need 16 bytes*/
 	bool IMEI(char *imei);
 	bool CIMI(char *cimi);//ID sim card
 	bool battery(uint16_t &bat_status, uint16_t &bat_percent, uint16_t &bat_voltage);
-	bool location(char *&lat, char *&lon, char *&date, char *&time);
+	bool location(sim800_location &loc);
+	bool registration(uint16_t &stat);
 	bool status();
-	bool connect(const char *address, unsigned short int port, uint16_t timeout = SIM800_CMD_TIMEOUT);
+	bool connect(const char *address, unsigned short int port, uint32_t timeout = SIM800_CMD_TIMEOUT);
 	bool disconnect();
 	bool send(char *buffer, size_t size, unsigned long int &accepted);
 	size_t receive(char *buffer, size_t size);
@@ -78,48 +422,346 @@ public:
 	*/
 
 	unsigned short int HTTP_get(const char *url, unsigned long int *length);
+	/*into a stream; 1011 when the body could not be read up to *length, 1012 on a short write to the sink*/
 	unsigned short int HTTP_get(const char *url, unsigned long int *length, STREAM &file);
+	/*same with the sink written by the writer task of a sim800_pipe*/
+	unsigned short int HTTP_get(const char *url, unsigned long int *length, sim800_pipe &pipe);
 	size_t HTTP_read(char *buffer, uint32_t start, size_t length);
 	size_t HTTP_read_ota(esp_ota_handle_t ota_handle, uint32_t start, size_t length);
 	unsigned short int HTTP_post(const char *url, unsigned long int *length);
 	unsigned short int HTTP_post(const char *url, unsigned long int *length, char *buffer, uint32_t size);
 	unsigned short int HTTP_post(const char *url, unsigned long int &length, STREAM &file, uint32_t size);
-	bool expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_AT_OK(const __FlashStringHelper *cmd, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect(const __FlashStringHelper *expected, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_OK(uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_scan(const __FlashStringHelper *pattern, void *ref, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, void *ref3, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
-	size_t read(char *buffer, size_t length);
-	inline size_t read_ota(esp_ota_handle_t ota_handle, size_t length);
-	size_t readline(char *buffer, size_t max, uint16_t timeout);
+	/**
+	* Posts a CBOR body encoded on the fly: encode() runs once against a
+	* counter for AT+HTTPDATA and once more straight into the UART, so it
+	* must produce the same bytes both times, otherwise the request is
+	* dropped with 1009.
+	* setContentType() overrides the content type of all posts, by default
+	* this one sends application/cbor, the buffer post
+	* application/x-www-form-urlencoded and the stream post none.
+	*/
+	unsigned short int HTTP_post(const char *url, unsigned long int &length, sim800_encode_fn encode, void *arg);
+	void setContentType(const char *type);
+
+	/**
+	* FTP transfers are not bound by the HTTP stack limits. Data is moved
+	* in chunks of up to GSM_MAX_BUFFSIZE whenever the modem signals it is
+	* ready with a +FTPGET/+FTPPUT URC. Returns 0 on success, the modem FTP
+	* error code (61..86) or a local error code (1000+) otherwise; a failed
+	* transfer ends the session with AT+FTPQUIT. FTP_put returns 1011 when
+	* the stream ended before size bytes.
+	*/
+	unsigned short int FTP_get(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, const char *user = NULL, const char *pass = NULL, unsigned short int port = 21);
+	unsigned short int FTP_get(const char *server, const char *path, const char *name, unsigned long int &length, esp_ota_handle_t ota_handle, const char *user = NULL, const char *pass = NULL, unsigned short int port = 21);
+	unsigned short int FTP_put(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, uint32_t size, const char *user = NULL, const char *pass = NULL, unsigned short int port = 21);
+	bool expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_AT_OK(const __FlashStringHelper *cmd, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect(const __FlashStringHelper *expected, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_OK(sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_scan(const __FlashStringHelper *pattern, void *ref, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2, void *ref3, sim800_deadline deadline = SIM800_SERIAL_TIMEOUT);
+	/*block reads, what arrived by the deadline if it expires first*/
+	size_t read(char *buffer, size_t length, const sim800_deadline &deadline);
+	size_t read_ota(esp_ota_handle_t ota_handle, size_t length, const sim800_deadline &deadline);
+	size_t readline(char *buffer, size_t max, const sim800_deadline &deadline);
 	void print(const char *s);
 	void print(uint32_t s);
 	void println(const char *s);
 	void println(uint32_t s);
 	bool check_sim_card();
+	bool sim_ready(uint32_t timeout = SIM800_SIM_TIMEOUT);
+	bool wait_ready(uint32_t timeout = SIM800_BOOT_TIMEOUT);
 	int get_signal(int& ber);
 	bool gsm_init();
 	void update_esp(String url_update);
 	void set_operator();
 
-	HardwareSerial _serial = HardwareSerial(1);
+	/**
+	* Status cache: each value is refreshed when older than its ttl, either
+	* by status_refresh() or by the task started with status_start(). The
+	* getters copy the last value without touching the UART and return
+	* false if it is stale or was never read.
+	*/
+	bool status_signal(sim800_signal &out);
+	bool status_battery(sim800_battery &out);
+	bool status_clock(sim800_clock &out);
+	bool status_registration(sim800_registration &out);
+	bool status_location(sim800_location &out);
+	void status_ttl(uint8_t item, uint32_t ttl);
+	void status_refresh(bool force = false);
+	bool status_start(uint32_t period = SIM800_STATUS_PERIOD, bool network_time = true);
+	/*returns once the task has exited, not to be called while holding lock()*/
+	void status_stop();
+	/**
+	* The UART lock, recursive: every public call that talks to the modem
+	* holds it, and a task can hold it across several calls to keep a
+	* command sequence together. hold takes it for a scope.
+	*/
+	bool lock(uint32_t timeout = portMAX_DELAY);
+	void unlock();
+	class hold
+	{
+	public:
+		hold(sim800 &modem) : _modem(modem) { _modem.lock(); }
+		~hold() { _modem.unlock(); }
+	private:
+		sim800 &_modem;
+	};
+
+	/**
+	* All library buffers come from a fixed arena inside the instance,
+	* one buffer per class. The report lists size, high-water mark and
+	* acquire counts per class, SIM800_BUF_LINE tracks the longest line
+	* read into the stack buffers of expect*().
+	*/
+	void memory_report(sim800_memory report[SIM800_BUF_CLASSES]);
+
+	/**
+	* Per command class counters and latency histograms. The latency of a
+	* command runs from sending it until the last response line read
+	* before the next command. Also counts URCs by urc_status index, UART
+	* bytes and the time spent sleeping in the library.
+	*/
+	void stats_snapshot(sim800_stats &out);
+	void stats_reset();
+	bool load_session();
+	bool save_session();
+	void clear_session();
+	/**
+	* Learns the time to the first response line of each command, keyed by
+	* its first SIM800_RTT_KEY characters. Once SIM800_RTT_TRUST samples are
+	* in, the rto, srtt + 4 * rttvar (at least SIM800_RTO_MIN) doubled per
+	* consecutive timeout, is how long the idempotent polls (CREG?, CGATT?,
+	* CIFSR, SAPBR=2) wait for an answer, capped by SIM800_SERIAL_TIMEOUT and
+	* the caller's deadline, and paces their retries through retry_after().
+	* Other commands are awaited up to the caller's timeout. gsm_init() loads the estimates from NVS and saves
+	* them once it is online.
+	*/
+	bool load_rtt();
+	bool save_rtt();
+	void clear_rtt();
+	void rtt_snapshot(sim800_rtt out[SIM800_RTT_SLOTS]);
+
+	/**
+	* Brings the bearer back with the cheapest tier that works: check it,
+	* reopen it (SAPBR), re-attach (CGATT), restart the radio (CFUN) and
+	* finally a PWRKEY power cycle with a full gsm_init(). A failed tier
+	* escalates to the next one after a jittered exponential backoff. While
+	* health is below SIM800_HEALTH_LOW the cheap tiers are skipped and the
+	* last tier that worked is tried first.
+	*/
+	bool online();
+	bool recover(uint32_t timeout = SIM800_RECOVERY_TIMEOUT);
+	void recovery_report(sim800_recovery &out);
+
+	/**
+	* Link quality from +CSQ, sampled by link_sample() at most every
+	* SIM800_LINK_PERIOD while transfers run and shared with the status
+	* cache. The band (0 weak .. 3 strong) sets the HTTPREAD chunk size
+	* and how often a failed chunk is retried. Bulk work (spool flushes,
+	* OTA, SIM800_PRIO_BULK jobs) waits while the band is below
+	* SIM800_LINK_BULK_BAND, at most SIM800_LINK_DEFER_MAX. Goodput is
+	* accounted per band in sim800_stats.
+	*/
+	void link_sample();
+	uint8_t link_band();
+	bool link_bulk_ok(uint32_t waited = 0);
+	size_t link_chunk(size_t max);
+	uint8_t link_retries();
+
+	/**
+	* Lets the modem sleep while it stays registered with the bearer open:
+	* SIM800_SLEEP_DTR (AT+CSCLK=1) sleeps while DTR is high,
+	* SIM800_SLEEP_AT (AT+CSCLK=2) sleeps when the UART is idle and is
+	* woken by AT lines, AUTO picks DTR if the board has it. wake() gets the
+	* modem answering again and checks the bearer with one AT+SAPBR=2,1,
+	* false means it was lost and recover() is due. Any command wakes the
+	* modem first; sleep_poll() wakes it when RI fell or a URC arrived.
+	* The status cache is not refreshed while the modem sleeps. Idle
+	* current is measured on the supply while sleeping() is true.
+	*/
+	bool sleep(uint8_t mode = SIM800_SLEEP_AUTO);
+	bool wake();
+	bool sleeping();
+	bool sleep_poll();
+	void sleep_report(sim800_sleep_stats &out);
+#ifdef SIM800_TRACE
+	/**
+	* Writes the recorded UART traffic, oldest first, in the format
+	* sim800_replay::load() reads. The recorder keeps the last
+	* SIM800_TRACE_CHUNKS chunks and is only built with SIM800_TRACE.
+	*/
+	size_t trace_dump(Stream &out);
+	void trace_clear();
+#endif
+#ifdef SIM800_REPLAY
+	sim800_replay &replay() { return _serial; }
+#endif
 
 protected:
-	const uint32_t _serialSpeed = SIM800_BAUD;
-	const __FlashStringHelper *_apn;
-	const __FlashStringHelper *_user;
-	const __FlashStringHelper *_pass;
+	SIM800_SERIAL _serial;
+	const sim800_board _board;
+	uint32_t _serialSpeed = SIM800_BAUD;
+	uint8_t _baud_errors = 0;
+	bool _flow_control = false;
+	bool _uart_started = false;
+	const char *_content_type = NULL;
+	const __FlashStringHelper *_apn = NULL;
+	const __FlashStringHelper *_user = NULL;
+	const __FlashStringHelper *_pass = NULL;
 	void eat_echo();
+	size_t expect_line(char *buf, const sim800_deadline &deadline);
+	size_t write(const uint8_t *buffer, size_t size);
+	void pause(uint32_t ms);
+	void command_begin();
+	void command_sent();
+	void command_end();
+	uint8_t rtt_slot();
+	uint32_t rto(uint8_t slot, uint32_t cap);
+	uint32_t answer_wait(uint32_t cap);
+	uint32_t retry_after(uint8_t attempt, uint32_t cap);
+	void rtt_sample(uint8_t slot, uint32_t ms);
+	bool recover_tier(uint8_t tier);
+	bool radio_reset();
+	void booting();
+	void wait_booted();
+	void power_off();
+	uint32_t backoff(uint8_t attempt);
+	void link_account(uint8_t band, uint32_t bytes, uint32_t ms);
+	static void ri_isr(void *arg);
+	bool probe_baud();
+	const char *nvs_key(char *key, const char *name);
+	unsigned short int HTTP_post_begin(const char *url, uint32_t size, uint32_t time, const char *content);
+	unsigned short int HTTP_post_end(unsigned long int &length, const sim800_deadline &deadline);
+	uint32_t line_ms(size_t bytes);
+
+	/*UART writes for encoders, see HTTP_post(url, length, encode, arg); at most
+	limit bytes reach the modem, the rest is counted but dropped*/
+	class sink : public Print
+	{
+	public:
+		size_t sent = 0;
+
+		sink(sim800 &modem, size_t limit) : _modem(modem), _limit(limit) {}
+		size_t write(uint8_t c) { return write(&c, 1); }
+		size_t write(const uint8_t *buffer, size_t size)
+		{
+			size_t n = size < _limit - sent ? size : _limit - sent;
+			if (n) sent += _modem.write(buffer, n);
+			return size;
+		}
+		// zeros up to the limit, so the modem leaves DOWNLOAD
+		void pad()
+		{
+			static const uint8_t zero[16] = {0};
+			size_t n;
+			while (sent < _limit && (n = _modem.write(zero, _limit - sent < sizeof(zero) ? _limit - sent : sizeof(zero)))) sent += n;
+		}
+	protected:
+		sim800 &_modem;
+		size_t _limit;
+	};
+	void *acquire(uint8_t pool, size_t len);
+	void release(uint8_t pool);
+	bool set_bearer();
+	bool wait_pin(uint8_t pin, int level, uint32_t timeout);
 	bool is_urc(const char *line, size_t len);
+	void handle_urc(uint8_t urc, const char *line);
+	bool wait_urc(uint8_t urc, uint32_t timeout);
+	unsigned short int FTP_begin(const char *server, const char *user, const char *pass, unsigned short int port);
+	unsigned short int FTP_get_begin(const char *server, const char *path, const char *name, const char *user, const char *pass, unsigned short int port);
+	unsigned short int FTP_receive(STREAM *file, esp_ota_handle_t ota_handle, unsigned long int &length);
+	unsigned short int FTP_send(const char *server, const char *path, const char *name, unsigned long int &length, STREAM &file, uint32_t size, const char *user, const char *pass, unsigned short int port);
+
+	template <typename T> bool snapshot(const sim800_cached<T> &c, T &out)
+	{
+		uint32_t seq, updated;
+		do
+		{
+			while((seq = c.seq) & 1) taskYIELD();
+			__sync_synchronize();
+			memcpy(&out, (const void *) &c.value, sizeof(T));
+			updated = c.updated;
+			__sync_synchronize();
+		}
+		while(seq != c.seq);
+		return updated && millis() - updated < c.ttl;
+	}
+
+	// writers hold the UART lock, readers retry while seq is odd or moved
+	template <typename T> void store(sim800_cached<T> &c, const T &value)
+	{
+		__sync_fetch_and_add(&c.seq, 1);
+		memcpy((void *) &c.value, &value, sizeof(T));
+		uint32_t now = millis();
+		c.updated = now ? now : 1;// 0 means never, a later stamp would read as expired
+		__sync_fetch_and_add(&c.seq, 1);
+	}
 
-	const char* operators[4] = {"Bee Line GSM", "MTS", "MegaFon", "TELE2"};
-	const char* apns[4] = {"internet.beeline.ru", "internet.mts.ru", "internet", "internet.tele2.ru"};
-	const char* users[4] = {"beeline", "mts", "gdata", NULL};
-	const char* pwds[4] = {"beeline", "mts", "gdata", NULL};
-	int current_operator = 0;
+	sim800_cached<sim800_signal> _status_signal = {0, 10000, 0, {0, 99}};
+	sim800_cached<sim800_battery> _status_battery = {0, 60000, 0, {0, 0, 0}};
+	sim800_cached<sim800_clock> _status_clock = {0, 60000, 0, {"", "", ""}};
+	sim800_cached<sim800_registration> _status_registration = {0, 10000, 0, {0}};
+	sim800_cached<sim800_location> _status_location = {0, 600000, 0, {"", "", "", ""}};
+	SemaphoreHandle_t _lock = NULL;
+	TaskHandle_t _status_task = NULL;
+	SemaphoreHandle_t _status_done = NULL;
+	volatile bool _status_running = false;
+	uint32_t _status_period = SIM800_STATUS_PERIOD;
+	// the clock from *PSUTTZ/+CTZV, stored by the next status_refresh()
+	sim800_clock _clock_urc;
+	bool _clock_urc_pending = false;
+	static void status_task(void *arg);
+	void status_urc(uint8_t urc, const char *line);
+
+	uint8_t _buf_io[SIM800_BUFSIZE];
+	uint8_t _buf_ota[OTA_BUFFSIZE];
+	uint8_t _buf_bulk[GSM_MAX_BUFFSIZE];
+	sim800_memory _memory[SIM800_BUF_CLASSES] = {
+		{SIM800_BUFSIZE, 0, 0, 0, false},
+		{OTA_BUFFSIZE, 0, 0, 0, false},
+		{GSM_MAX_BUFFSIZE, 0, 0, 0, false},
+		{SIM800_BUFSIZE, 0, 0, 0, false}
+	};
+
+	sim800_stats _stats;
+	bool _cmd_open = false;
+	bool _cmd_failed = false;
+	uint8_t _cmd_class = SIM800_CMD_OTHER;
+	uint8_t _cmd_head_len = 0;
+	char _cmd_head[16];
+	uint32_t _cmd_start = 0;
+	uint32_t _cmd_last = 0;
+	uint32_t _cmd_sent = 0;
+	uint8_t _cmd_rtt = SIM800_RTT_SLOTS;
+	bool _cmd_answered = true;
+	bool _cmd_sample = false;
+	sim800_rtt _rtt[SIM800_RTT_SLOTS];
+	sim800_recovery _recovery = {{0}, {0}, 0, 0, 0, 0, 100, SIM800_TIER_BEARER};
+	uint32_t _ota_deferred = 0;
+	uint8_t _sleep_mode = 0;
+	volatile bool _asleep = false;
+	bool _booted = false;
+	volatile bool _ri_pending = false;
+	bool _sleep_bearer = false;
+	uint32_t _sleep_start = 0;
+	sim800_sleep_stats _sleep_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+#ifdef SIM800_TRACE
+	sim800_trace_chunk _trace[SIM800_TRACE_CHUNKS];
+	uint32_t _trace_head = 0;
+	uint32_t _trace_count = 0;
+	void trace(uint8_t dir, const uint8_t *data, size_t len);
+#endif
+
+	int _ftp_code = 0;
+	unsigned long int _ftp_max = 0;
+
+	const sim800_apn *_apn_table = NULL;
+	size_t _apn_table_len = 0;
+	uint32_t current_operator = 0;
 };
 
 // this useful list found here: https://github.com/cloudyourcar/attentive
@@ -151,7 +793,30 @@ const char * const urc_15 PROGMEM = "UNDER-VOLTAGE POWER DOWN";
 const char * const urc_16 PROGMEM = "UNDER-VOLTAGE WARNNING";
 const char * const urc_17 PROGMEM = "OVER-VOLTAGE POWER DOWN";
 const char * const urc_18 PROGMEM = "OVER-VOLTAGE WARNNING";
+/* FTP upload state change notification */
+const char * const urc_19 PROGMEM = "+FTPPUT: 1,";
+
+const char * const _urc_messages[] PROGMEM = {urc_01, urc_02, urc_03, urc_04, urc_06, urc_07, urc_08, urc_09, urc_10, urc_11, urc_12, urc_13, urc_14, urc_15, urc_16, urc_17, urc_18, urc_19};
 
-const char * const _urc_messages[] PROGMEM = {urc_01, urc_02, urc_03, urc_04, urc_06, urc_07, urc_08, urc_09, urc_10, urc_11, urc_12, urc_13, urc_14, urc_15, urc_16, urc_17, urc_18};
+/* indices into _urc_messages, as reported in urc_status and urc_pending */
+#define URC_CIPRXGET       0
+#define URC_FTPGET         1
+#define URC_PDP_DEACT      2
+#define URC_SAPBR_DEACT    3
+#define URC_PSUTTZ         4
+#define URC_CTZV           5
+#define URC_DST            6
+#define URC_CIEV           7
+#define URC_RDY            8
+#define URC_CPIN_READY     9
+#define URC_CALL_READY     10
+#define URC_SMS_READY      11
+#define URC_POWER_DOWN     12
+#define URC_UV_POWER_DOWN  13
+#define URC_UV_WARNING     14
+#define URC_OV_POWER_DOWN  15
+#define URC_OV_WARNING     16
+#define URC_FTPPUT         17
+#define URC_COUNT (sizeof(_urc_messages) / sizeof(_urc_messages[0]))
 
 #endif //SIM800_H
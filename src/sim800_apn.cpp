@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include "sim800_apn.h"
+
+// keep sorted by plmn, this is checked when compiling
+static constexpr sim800_apn _apn_table[] PROGMEM = {
+	{SIM800_PLMN(250, 1, 2), "internet.mts.ru", "mts", "mts"},
+	{SIM800_PLMN(250, 2, 2), "internet", "gdata", "gdata"},
+	{SIM800_PLMN(250, 11, 2), "internet.yota", NULL, NULL},
+	{SIM800_PLMN(250, 20, 2), "internet.tele2.ru", NULL, NULL},
+	{SIM800_PLMN(250, 99, 2), "internet.beeline.ru", "beeline", "beeline"},
+	{SIM800_PLMN(262, 2, 2), "web.vodafone.de", NULL, NULL},
+	{SIM800_PLMN(262, 7, 2), "internet", NULL, NULL},
+};
+
+static constexpr size_t _apn_table_len = sizeof(_apn_table) / sizeof(_apn_table[0]);
+
+static constexpr bool apn_sorted(const sim800_apn *table, size_t len)
+{
+	return len < 2 || (table[0].plmn < table[1].plmn && apn_sorted(table + 1, len - 1));
+}
+
+static_assert(apn_sorted(_apn_table, _apn_table_len), "_apn_table must be sorted by plmn");
+
+const sim800_apn *apn_lookup(uint32_t plmn, const sim800_apn *table, size_t len)
+{
+	size_t lo = 0, hi = len;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if(table[mid].plmn == plmn) return &table[mid];
+		if(table[mid].plmn < plmn) lo = mid + 1;
+		else hi = mid;
+	}
+	return NULL;
+}
+
+const sim800_apn *apn_lookup(uint32_t plmn)
+{
+	return apn_lookup(plmn, _apn_table, _apn_table_len);
+}
+
+// "25001" or "310410", the first three digits are the MCC
+uint32_t apn_plmn(const char *numeric)
+{
+	size_t len = strlen(numeric);
+	if(len < 5 || len > 6) return 0;
+	uint32_t mcc = 0, mnc = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		if(numeric[i] < '0' || numeric[i] > '9') return 0;
+		if(i < 3) mcc = mcc * 10 + (numeric[i] - '0');
+		else mnc = mnc * 10 + (numeric[i] - '0');
+	}
+	return SIM800_PLMN(mcc, mnc, len - 3);
+}
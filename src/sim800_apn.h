@@ -0,0 +1,26 @@
+#ifndef SIM800_APN_H
+#define SIM800_APN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*numeric operator id, (MCC * 1000 + MNC) * 10 + MNC digits, so 310-41 and 310-041 differ*/
+#define SIM800_PLMN(mcc, mnc, digits) (((uint32_t) (mcc) * 1000 + (mnc)) * 10 + (digits))
+
+struct sim800_apn
+{
+	uint32_t plmn;
+	const char *apn;
+	const char *user;
+	const char *pass;
+};
+
+/**
+* Binary search for the operator in a table sorted by plmn. Without a
+* table the built-in one is searched, which lives in flash.
+*/
+const sim800_apn *apn_lookup(uint32_t plmn, const sim800_apn *table, size_t len);
+const sim800_apn *apn_lookup(uint32_t plmn);
+uint32_t apn_plmn(const char *numeric);
+
+#endif //SIM800_APN_H
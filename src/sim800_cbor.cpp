@@ -0,0 +1,107 @@
+#include <Arduino.h>
+#include "sim800_cbor.h"
+
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_SIMPLE 7
+
+sim800_cbor::sim800_cbor(Print &out) : _out(out) {}
+
+void sim800_cbor::begin_map(size_t entries)
+{
+	head(CBOR_MAP, entries);
+}
+
+void sim800_cbor::begin_array(size_t items)
+{
+	head(CBOR_ARRAY, items);
+}
+
+void sim800_cbor::write_uint(uint64_t v)
+{
+	head(CBOR_UINT, v);
+}
+
+// negative n is encoded as -1 - n
+void sim800_cbor::write_int(int64_t v)
+{
+	if(v < 0) head(CBOR_NINT, (uint64_t) (-1 - v));
+	else head(CBOR_UINT, v);
+}
+
+void sim800_cbor::write_str(const char *s)
+{
+	write_str(s, strlen(s));
+}
+
+void sim800_cbor::write_str(const char *s, size_t len)
+{
+	head(CBOR_TEXT, len);
+	put((const uint8_t *) s, len);
+}
+
+void sim800_cbor::write_bytes(const uint8_t *data, size_t len)
+{
+	head(CBOR_BYTES, len);
+	put(data, len);
+}
+
+void sim800_cbor::write_float(float v)
+{
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	uint8_t b[5] = {(CBOR_SIMPLE << 5) | 26, (uint8_t) (bits >> 24), (uint8_t) (bits >> 16), (uint8_t) (bits >> 8), (uint8_t) bits};
+	put(b, sizeof(b));
+}
+
+void sim800_cbor::write_bool(bool v)
+{
+	uint8_t b = (CBOR_SIMPLE << 5) | (v ? 21 : 20);
+	put(&b, 1);
+}
+
+void sim800_cbor::write_null()
+{
+	uint8_t b = (CBOR_SIMPLE << 5) | 22;
+	put(&b, 1);
+}
+
+// major type and argument in the shortest form
+void sim800_cbor::head(uint8_t major, uint64_t v)
+{
+	uint8_t b[9];
+	uint8_t n = 1;
+	major <<= 5;
+	if(v < 24) b[0] = major | v;
+	else if(v <= 0xff)
+	{
+		b[0] = major | 24;
+		n = 2;
+	}
+	else if(v <= 0xffff)
+	{
+		b[0] = major | 25;
+		n = 3;
+	}
+	else if(v <= 0xffffffffULL)
+	{
+		b[0] = major | 26;
+		n = 5;
+	}
+	else
+	{
+		b[0] = major | 27;
+		n = 9;
+	}
+	for(uint8_t i = n - 1; i > 0; i--, v >>= 8) b[i] = v & 0xff;
+	put(b, n);
+}
+
+void sim800_cbor::put(const uint8_t *data, size_t len)
+{
+	written += _out.write(data, len);
+}
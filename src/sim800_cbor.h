@@ -0,0 +1,47 @@
+#ifndef SIM800_CBOR_H
+#define SIM800_CBOR_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#define SIM800_CBOR_CONTENT_TYPE "application/cbor"
+
+/**
+* Minimal CBOR (RFC 8949) encoder writing straight to a Print, so a body
+* can go to the modem without being built in RAM first. Only definite
+* lengths: maps and arrays are opened with their number of entries.
+* written counts the bytes produced.
+*/
+class sim800_cbor
+{
+public:
+	size_t written = 0;
+
+	sim800_cbor(Print &out);
+	void begin_map(size_t entries);
+	void begin_array(size_t items);
+	void write_uint(uint64_t v);
+	void write_int(int64_t v);
+	void write_str(const char *s);
+	void write_str(const char *s, size_t len);
+	void write_bytes(const uint8_t *data, size_t len);
+	void write_float(float v);
+	void write_bool(bool v);
+	void write_null();
+
+protected:
+	Print &_out;
+	void head(uint8_t major, uint64_t v);
+	void put(const uint8_t *data, size_t len);
+};
+
+/*a Print that only counts, for the sizing pass before AT+HTTPDATA*/
+class sim800_counter : public Print
+{
+public:
+	size_t count = 0;
+	size_t write(uint8_t) { count++; return 1; }
+	size_t write(const uint8_t *, size_t size) { count += size; return size; }
+};
+
+#endif //SIM800_CBOR_H
@@ -0,0 +1,22 @@
+#ifndef SIM800_DEBUG_H
+#define SIM800_DEBUG_H
+
+/*serial logging of the library sources, compiled in with DEBUG_SIM800;
+include it from .cpp files only*/
+#ifdef DEBUG_SIM800
+#define PRINT(s) Serial.print(F(s))
+#define PRINTLN(s) Serial.println(F(s))
+#define DEBUG(...) Serial.print(__VA_ARGS__)
+#define DEBUGQ(...) Serial.print("'"); Serial.print(__VA_ARGS__); Serial.print("'")
+#define DEBUGLN(...) Serial.println(__VA_ARGS__)
+#define DEBUGQLN(...) Serial.print("'"); Serial.print(__VA_ARGS__); Serial.println("'")
+#else
+#define PRINT(s)
+#define PRINTLN(s)
+#define DEBUG(...)
+#define DEBUGQ(...)
+#define DEBUGLN(...)
+#define DEBUGQLN(...)
+#endif
+
+#endif //SIM800_DEBUG_H
@@ -0,0 +1,63 @@
+#include <Arduino.h>
+#include "sim800.h"
+
+// +CSQ rssi is 0..31, 99 if not known or not detectable
+static uint8_t band_of(int rssi)
+{
+	if(rssi == 99 || rssi < 10) return 0;
+	if(rssi < 15) return 1;
+	if(rssi < 20) return 2;
+	return 3;
+}
+
+// the caller holds the UART, as for any other command
+void sim800::link_sample()
+{
+	hold h(*this);
+	if(_status_signal.updated && millis() - _status_signal.updated < SIM800_LINK_PERIOD) return;
+	sim800_signal v = {0, 99};
+	println(F("AT+CSQ"));
+	if(!expect_scan(F("+CSQ: %d,%d"), &v.rssi, &v.ber) || !expect_OK()) return;
+	store(_status_signal, v);
+	gsm_rssi = v.rssi;
+	gsm_ber = v.ber;
+}
+
+uint8_t sim800::link_band()
+{
+	sim800_signal v;
+	snapshot(_status_signal, v);
+	return band_of(v.rssi);
+}
+
+// nothing known about the link does not hold work back
+bool sim800::link_bulk_ok(uint32_t waited)
+{
+	sim800_signal v;
+	if(!snapshot(_status_signal, v)) return true;
+	return band_of(v.rssi) >= SIM800_LINK_BULK_BAND || waited >= SIM800_LINK_DEFER_MAX;
+}
+
+// max in the strongest band, halved per band below
+size_t sim800::link_chunk(size_t max)
+{
+	size_t chunk = max >> (SIM800_LINK_BANDS - 1 - link_band());
+	if(chunk < SIM800_BUFSIZE) chunk = SIM800_BUFSIZE;
+	return chunk < max ? chunk : max;
+}
+
+uint8_t sim800::link_retries()
+{
+	return SIM800_LINK_BANDS - link_band();
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+void sim800::link_account(uint8_t band, uint32_t bytes, uint32_t ms)
+{
+	_stats.goodput_bytes[band] += bytes;
+	_stats.goodput_ms[band] += ms;
+}
@@ -0,0 +1,371 @@
+#include <Arduino.h>
+#include "sim800_mqtt.h"
+#include "sim800_debug.h"
+
+static size_t varint_len(size_t remaining)
+{
+	if(remaining < 128) return 1;
+	if(remaining < 16384) return 2;
+	if(remaining < 2097152) return 3;
+	return 4;
+}
+
+sim800_mqtt::sim800_mqtt(sim800 &modem) : _modem(modem)
+{
+	memset(_inflight, 0, sizeof(_inflight));
+}
+
+void sim800_mqtt::set_callback(mqtt_callback callback)
+{
+	_callback = callback;
+}
+
+bool sim800_mqtt::connect(const char *host, unsigned short int port, const char *client_id,
+	const char *user, const char *pass, uint16_t keepalive)
+{
+	_connected = false;
+	_connack = false;
+	_tx_len = _rx_len = _rx_skip = 0;
+	_ping_sent = 0;
+	memset(_inflight, 0, sizeof(_inflight));
+	if(!_modem.connect(host, port)) return false;
+	uint16_t cid_len = strlen(client_id);
+	uint16_t user_len = user ? strlen(user) : 0;
+	uint16_t pass_len = pass ? strlen(pass) : 0;
+	size_t remaining = 10 + 2 + cid_len;
+	if(user) remaining += 2 + user_len;
+	if(pass) remaining += 2 + pass_len;
+	if(!reserve(1 + varint_len(remaining) + remaining)) return false;
+	uint8_t *p = header(MQTT_CONNECT, remaining);
+	p = put_string(p, "MQTT", 4);
+	*p++ = 4;// protocol level 3.1.1
+	*p++ = 0x02 | (user ? 0x80 : 0) | (pass ? 0x40 : 0);// clean session
+	*p++ = keepalive >> 8;
+	*p++ = keepalive & 0xff;
+	p = put_string(p, client_id, cid_len);
+	if(user) p = put_string(p, user, user_len);
+	if(pass) p = put_string(p, pass, pass_len);
+	_tx_len = p - (uint8_t *) _tx;
+	_keepalive = keepalive;
+	if(!flush()) return false;
+	uint32_t start = millis();
+	while(!_connack && millis() - start < MQTT_CONNACK_TIMEOUT)
+	{
+		if(!poll()) vTaskDelay(100 / portTICK_RATE_MS);
+	}
+#ifdef DEBUG_PROGRESS
+	PRINT("MQTT CONNACK ");
+	DEBUGLN(_connack);
+#endif
+	_connected = _connack;
+	if(!_connected) _modem.disconnect();
+	return _connected;
+}
+
+bool sim800_mqtt::connected()
+{
+	return _connected;
+}
+
+void sim800_mqtt::disconnect()
+{
+	if(!_connected) return;
+	if(reserve(2))
+	{
+		uint8_t *p = header(MQTT_DISCONNECT, 0);
+		_tx_len = p - (uint8_t *) _tx;
+		flush();
+	}
+	_modem.disconnect();
+	_connected = false;
+}
+
+bool sim800_mqtt::publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain)
+{
+	if(!_connected || qos > 1) return false;
+	inflight_msg *slot = NULL;
+	uint16_t id = 0;
+	if(qos)
+	{
+		for(uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+		{
+			if(!_inflight[i].id)
+			{
+				slot = &_inflight[i];
+				break;
+			}
+		}
+		if(!slot) return false;
+		id = next_id();
+	}
+	if(!put_publish(topic, payload, len, qos, retain, false, id)) return false;
+	if(slot)
+	{
+		slot->id = id;
+		slot->retries = 0;
+		slot->retain = retain;
+		slot->sent = millis();
+		slot->topic = topic;
+		slot->payload = payload;
+		slot->len = len;
+	}
+	return true;
+}
+
+bool sim800_mqtt::subscribe(const char *topic, uint8_t qos)
+{
+	if(!_connected) return false;
+	uint16_t topic_len = strlen(topic);
+	size_t remaining = 2 + 2 + topic_len + 1;
+	if(!reserve(1 + varint_len(remaining) + remaining)) return false;
+	uint16_t id = next_id();
+	uint8_t *p = header(MQTT_SUBSCRIBE, remaining);
+	*p++ = id >> 8;
+	*p++ = id & 0xff;
+	p = put_string(p, topic, topic_len);
+	*p++ = qos;
+	_tx_len = p - (uint8_t *) _tx;
+	return flush();
+}
+
+bool sim800_mqtt::flush()
+{
+	if(!_tx_len) return true;
+	unsigned long int accepted = 0;
+	bool ok = _modem.send(_tx, _tx_len, accepted);
+#ifdef DEBUG_PACKETS
+	PRINT("~~~ MQTT SENT: ");
+	DEBUGLN(_tx_len);
+#endif
+	_tx_len = 0;
+	_last_out = millis();
+	if(!ok) _connected = false;
+	return ok;
+}
+
+bool sim800_mqtt::loop()
+{
+	if(!_connected) return false;
+	retransmit();
+	poll();
+	uint32_t now = millis();
+	uint32_t keepalive = _keepalive * 1000UL;
+	if(_ping_sent && now - _ping_sent > keepalive)
+	{
+	#ifdef DEBUG_PROGRESS
+		PRINTLN("MQTT PINGRESP timeout");
+	#endif
+		_modem.disconnect();
+		_connected = false;
+		return false;
+	}
+	if(keepalive && !_ping_sent && now - _last_out >= keepalive / 4 * 3 && reserve(2))
+	{
+		uint8_t *p = header(MQTT_PINGREQ, 0);
+		_tx_len = p - (uint8_t *) _tx;
+		_ping_sent = now;
+		pings++;
+	}
+	return flush();
+}
+
+uint8_t sim800_mqtt::inflight()
+{
+	uint8_t n = 0;
+	for(uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) if(_inflight[i].id) n++;
+	return n;
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+// make room for a packet, sending out what is batched if necessary
+bool sim800_mqtt::reserve(size_t packet_len)
+{
+	if(packet_len > MQTT_BUFFSIZE) return false;
+	if(_tx_len + packet_len > MQTT_BUFFSIZE) return flush();
+	return true;
+}
+
+// write the fixed header at the end of the send buffer
+uint8_t *sim800_mqtt::header(uint8_t type, size_t remaining)
+{
+	uint8_t *p = (uint8_t *) _tx + _tx_len;
+	*p++ = type;
+	do
+	{
+		uint8_t b = remaining % 128;
+		remaining /= 128;
+		if(remaining) b |= 0x80;
+		*p++ = b;
+	}
+	while(remaining);
+	return p;
+}
+
+uint8_t *sim800_mqtt::put_string(uint8_t *p, const char *s, uint16_t len)
+{
+	*p++ = len >> 8;
+	*p++ = len & 0xff;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+bool sim800_mqtt::put_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain, bool dup, uint16_t id)
+{
+	uint16_t topic_len = strlen(topic);
+	size_t remaining = 2 + topic_len + (qos ? 2 : 0) + len;
+	if(!reserve(1 + varint_len(remaining) + remaining)) return false;
+	uint8_t *p = header(MQTT_PUBLISH | (dup ? 0x08 : 0) | (qos << 1) | (retain ? 0x01 : 0), remaining);
+	p = put_string(p, topic, topic_len);
+	if(qos)
+	{
+		*p++ = id >> 8;
+		*p++ = id & 0xff;
+	}
+	memcpy(p, payload, len);
+	_tx_len = p + len - (uint8_t *) _tx;
+	return true;
+}
+
+bool sim800_mqtt::put_short(uint8_t type, uint16_t id)
+{
+	if(!reserve(4)) return false;
+	uint8_t *p = header(type, 2);
+	*p++ = id >> 8;
+	*p++ = id & 0xff;
+	_tx_len = p - (uint8_t *) _tx;
+	return true;
+}
+
+// fetch pending socket data and dispatch all complete packets
+bool sim800_mqtt::poll()
+{
+	size_t r = _modem.receive((char *) _rx + _rx_len, MQTT_RX_BUFFSIZE - _rx_len);
+	if(_rx_skip)
+	{
+		size_t s = min(_rx_skip, r);
+		memmove(_rx + _rx_len, _rx + _rx_len + s, r - s);
+		_rx_skip -= s;
+		r -= s;
+	}
+	_rx_len += r;
+	size_t pos = 0;
+	while(_rx_len - pos >= 2)
+	{
+		size_t remaining = 0, i = pos + 1;
+		uint8_t shift = 0;
+		bool complete = false;
+		while(i < _rx_len && shift < 28)
+		{
+			uint8_t b = _rx[i++];
+			remaining |= (size_t) (b & 0x7f) << shift;
+			shift += 7;
+			if(!(b & 0x80))
+			{
+				complete = true;
+				break;
+			}
+		}
+		if(!complete)
+		{
+			if(shift >= 28)// malformed length, the stream is lost
+			{
+				_connected = false;
+				pos = _rx_len;
+			}
+			break;
+		}
+		size_t total = (i - pos) + remaining;
+		if(total > MQTT_RX_BUFFSIZE)
+		{
+			dropped++;
+			_rx_skip = total - (_rx_len - pos);
+			pos = _rx_len;
+			break;
+		}
+		if(_rx_len - pos < total) break;
+		dispatch(_rx[pos], _rx + i, remaining);
+		pos += total;
+	}
+	memmove(_rx, _rx + pos, _rx_len - pos);
+	_rx_len -= pos;
+	return r > 0;
+}
+
+void sim800_mqtt::dispatch(uint8_t type, const uint8_t *body, size_t len)
+{
+#ifdef DEBUG_PACKETS
+	PRINT("~~~ MQTT PACKET: ");
+	DEBUG(type, HEX);
+	PRINT(" ");
+	DEBUGLN(len);
+#endif
+	switch(type & 0xf0)
+	{
+		case MQTT_CONNACK:
+			_connack = len >= 2 && body[1] == 0;
+			break;
+		case MQTT_PUBACK:
+			if(len >= 2)
+			{
+				uint16_t id = (body[0] << 8) | body[1];
+				for(uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+				{
+					if(_inflight[i].id == id) _inflight[i].id = 0;
+				}
+			}
+			break;
+		case MQTT_PINGRESP:
+			_ping_sent = 0;
+			break;
+		case MQTT_PUBLISH:
+		{
+			uint8_t qos = (type >> 1) & 0x03;
+			if(len < 2) break;
+			uint16_t topic_len = (body[0] << 8) | body[1];
+			if((size_t) 2 + topic_len + (qos ? 2 : 0) > len) break;
+			const uint8_t *p = body + 2 + topic_len;
+			uint16_t id = 0;
+			if(qos)
+			{
+				id = (p[0] << 8) | p[1];
+				p += 2;
+			}
+			if(_callback) _callback((const char *) body + 2, topic_len, p, body + len - p);
+			if(qos == 1) put_short(MQTT_PUBACK, id);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+// resend QoS1 publishes that were not acknowledged in time
+void sim800_mqtt::retransmit()
+{
+	uint32_t now = millis();
+	for(uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++)
+	{
+		inflight_msg &m = _inflight[i];
+		if(!m.id || now - m.sent < MQTT_RETRY_TIMEOUT) continue;
+		if(m.retries >= MQTT_MAX_RETRIES)
+		{
+			dropped++;
+			m.id = 0;
+			continue;
+		}
+		if(!put_publish(m.topic, m.payload, m.len, 1, m.retain, true, m.id)) continue;
+		m.sent = now;
+		m.retries++;
+		retransmits++;
+	}
+}
+
+uint16_t sim800_mqtt::next_id()
+{
+	if(!++_next_id) _next_id = 1;
+	return _next_id;
+}
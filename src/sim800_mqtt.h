@@ -0,0 +1,94 @@
+#ifndef SIM800_MQTT_H
+#define SIM800_MQTT_H
+
+#include "sim800.h"
+
+/*size of the outgoing packet buffer, one AT+CIPSEND worth of data*/
+#define MQTT_BUFFSIZE GSM_MAX_BUFFSIZE
+/*size of the incoming packet buffer, larger packets are dropped*/
+#define MQTT_RX_BUFFSIZE 256
+/*number of unacknowledged QoS1 publishes kept for retransmission*/
+#define MQTT_MAX_INFLIGHT 4
+#define MQTT_KEEPALIVE 60
+#define MQTT_CONNACK_TIMEOUT 10000
+#define MQTT_RETRY_TIMEOUT 10000
+#define MQTT_MAX_RETRIES 3
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xc0
+#define MQTT_PINGRESP    0xd0
+#define MQTT_DISCONNECT  0xe0
+
+typedef void (*mqtt_callback)(const char *topic, uint16_t topic_len, const uint8_t *payload, size_t len);
+
+/**
+* MQTT 3.1.1 client on top of the sim800 TCP socket (connect/send/receive).
+* Packets are encoded in place into a single send buffer, QoS0 publishes
+* are batched into one AT+CIPSEND until the buffer is full or flush() is
+* called. QoS1 publishes keep a reference to the caller's topic and
+* payload, both must stay valid until inflight() no longer counts them.
+*/
+class sim800_mqtt
+{
+public:
+	uint32_t pings = 0;
+	uint32_t retransmits = 0;
+	uint32_t dropped = 0;
+
+	sim800_mqtt(sim800 &modem);
+	void set_callback(mqtt_callback callback);
+	bool connect(const char *host, unsigned short int port, const char *client_id,
+		const char *user = NULL, const char *pass = NULL, uint16_t keepalive = MQTT_KEEPALIVE);
+	bool connected();
+	void disconnect();
+	bool publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos = 0, bool retain = false);
+	bool subscribe(const char *topic, uint8_t qos = 0);
+	bool flush();
+	bool loop();
+	uint8_t inflight();
+
+protected:
+	struct inflight_msg
+	{
+		uint16_t id;
+		uint8_t retries;
+		bool retain;
+		uint32_t sent;
+		const char *topic;
+		const uint8_t *payload;
+		size_t len;
+	};
+
+	sim800 &_modem;
+	mqtt_callback _callback = NULL;
+	bool _connected = false;
+	bool _connack = false;
+	uint16_t _keepalive = MQTT_KEEPALIVE;
+	uint16_t _next_id = 1;
+	uint32_t _last_out = 0;
+	uint32_t _ping_sent = 0;
+	inflight_msg _inflight[MQTT_MAX_INFLIGHT];
+
+	char _tx[MQTT_BUFFSIZE];
+	size_t _tx_len = 0;
+	uint8_t _rx[MQTT_RX_BUFFSIZE];
+	size_t _rx_len = 0;
+	size_t _rx_skip = 0;
+
+	bool reserve(size_t packet_len);
+	uint8_t *header(uint8_t type, size_t remaining);
+	uint8_t *put_string(uint8_t *p, const char *s, uint16_t len);
+	bool put_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain, bool dup, uint16_t id);
+	bool put_short(uint8_t type, uint16_t id);
+	bool poll();
+	void dispatch(uint8_t type, const uint8_t *body, size_t len);
+	void retransmit();
+	uint16_t next_id();
+};
+
+#endif //SIM800_MQTT_H
@@ -0,0 +1,104 @@
+#include <Arduino.h>
+#include "sim800_pipe.h"
+
+sim800_pipe::sim800_pipe(STREAM &file, uint8_t depth, BaseType_t core) :
+	_file(file), _depth(depth < 1 ? 1 : depth > SIM800_PIPE_DEPTH ? SIM800_PIPE_DEPTH : depth), _core(core)
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+// queues are made once, the writer task lives for one transfer
+bool sim800_pipe::open()
+{
+	if(_task) return false;
+	if(!_free) _free = xQueueCreate(SIM800_PIPE_DEPTH, sizeof(uint8_t *));
+	if(!_full) _full = xQueueCreate(SIM800_PIPE_DEPTH + 1, sizeof(chunk));
+	if(!_done) _done = xSemaphoreCreateBinary();
+	if(!_free || !_full || !_done) return false;
+	xQueueReset(_free);
+	xQueueReset(_full);
+	for(uint8_t i = 0; i < _depth; i++)
+	{
+		uint8_t *b = _buf[i];
+		xQueueSend(_free, &b, 0);
+	}
+	memset(&_stats, 0, sizeof(_stats));
+	_failed = false;
+	_start = millis();
+	if(xTaskCreatePinnedToCore(writer, "sim800_pipe", SIM800_PIPE_STACK, this, SIM800_PIPE_PRIORITY, &_task, _core) != pdPASS)
+	{
+		_task = NULL;
+		return false;
+	}
+	return true;
+}
+
+uint8_t *sim800_pipe::get(uint32_t timeout)
+{
+	uint8_t *b = NULL;
+	uint32_t start = millis();
+	if(xQueueReceive(_free, &b, timeout / portTICK_RATE_MS) != pdTRUE) b = NULL;
+	_stats.read_stall_ms += millis() - start;
+	return b;
+}
+
+bool sim800_pipe::put(uint8_t *buffer, size_t len)
+{
+	chunk c = {buffer, len};
+	if(xQueueSend(_full, &c, 0) != pdTRUE) return false;
+	uint8_t fill = uxQueueMessagesWaiting(_full);
+	if(fill > _stats.max_fill) _stats.max_fill = fill;
+	_stats.bytes += len;
+	_stats.chunks++;
+	return true;
+}
+
+void sim800_pipe::close(uint8_t *buffer)
+{
+	if(!_task) return;
+	if(buffer) xQueueSend(_free, &buffer, 0);
+	chunk end = {NULL, 0};
+	xQueueSend(_full, &end, portMAX_DELAY);
+	xSemaphoreTake(_done, portMAX_DELAY);
+	_task = NULL;
+	_stats.total_ms = millis() - _start;
+}
+
+bool sim800_pipe::failed()
+{
+	return _failed;
+}
+
+void sim800_pipe::report(sim800_pipe_stats &out)
+{
+	memcpy(&out, &_stats, sizeof(out));
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+// after a short write the rest is only handed back, not written
+void sim800_pipe::writer(void *arg)
+{
+	sim800_pipe *pipe = (sim800_pipe *) arg;
+	chunk c;
+	while(true)
+	{
+		uint32_t start = millis();
+		if(xQueueReceive(pipe->_full, &c, portMAX_DELAY) != pdTRUE) continue;
+		uint32_t got = millis();
+		pipe->_stats.write_stall_ms += got - start;
+		if(!c.data) break;
+		if(!pipe->_failed && pipe->_file.write(c.data, c.len) != c.len)
+		{
+			pipe->_stats.short_writes++;
+			pipe->_failed = true;
+		}
+		pipe->_stats.write_ms += millis() - got;
+		xQueueSend(pipe->_free, &c.data, portMAX_DELAY);
+	}
+	xSemaphoreGive(pipe->_done);
+	vTaskDelete(NULL);
+}
@@ -0,0 +1,71 @@
+#ifndef SIM800_PIPE_H
+#define SIM800_PIPE_H
+
+#include "sim800.h"
+#include "freertos/queue.h"
+
+/*most buffers a pipe can hold, each one HTTPREAD chunk*/
+#ifndef SIM800_PIPE_DEPTH
+#define SIM800_PIPE_DEPTH 4
+#endif
+#define SIM800_PIPE_BUFSIZE GSM_MAX_BUFFSIZE
+#define SIM800_PIPE_STACK 4096
+#define SIM800_PIPE_PRIORITY 2
+
+/*a stall is time one side waited for the other*/
+struct sim800_pipe_stats
+{
+	uint32_t bytes;
+	uint32_t chunks;
+	uint32_t total_ms;
+	uint32_t read_stall_ms;//reader waiting for a free buffer, the sink is behind
+	uint32_t write_stall_ms;//writer waiting for data, the link is behind
+	uint32_t write_ms;
+	uint32_t short_writes;
+	uint8_t max_fill;
+};
+
+/**
+* Buffers between HTTP_get(url, length, pipe) and a slow sink such as an
+* SD card file. The modem side fills up to depth buffers while a writer
+* task, pinned to core if given, empties them into the sink, so a write
+* stall no longer holds up the next HTTPREAD. With all buffers full the
+* reader waits, with none the writer does; report() has both stall times.
+* A short write stops the download. The buffers live in the instance.
+*/
+class sim800_pipe
+{
+public:
+	sim800_pipe(STREAM &file, uint8_t depth = SIM800_PIPE_DEPTH, BaseType_t core = tskNO_AFFINITY);
+	bool open();
+	/*a free buffer of SIM800_PIPE_BUFSIZE, NULL if the writer is stuck*/
+	uint8_t *get(uint32_t timeout = SIM800_HTTP_TIMEOUT);
+	bool put(uint8_t *buffer, size_t len);
+	/*hands back an unused buffer and waits until everything is written*/
+	void close(uint8_t *buffer = NULL);
+	bool failed();
+	void report(sim800_pipe_stats &out);
+
+protected:
+	struct chunk
+	{
+		uint8_t *data;
+		size_t len;
+	};
+
+	STREAM &_file;
+	const uint8_t _depth;
+	const BaseType_t _core;
+	QueueHandle_t _free = NULL;
+	QueueHandle_t _full = NULL;
+	SemaphoreHandle_t _done = NULL;
+	TaskHandle_t _task = NULL;
+	volatile bool _failed = false;
+	uint32_t _start = 0;
+	sim800_pipe_stats _stats;
+	uint8_t _buf[SIM800_PIPE_DEPTH][SIM800_PIPE_BUFSIZE];
+
+	static void writer(void *arg);
+};
+
+#endif //SIM800_PIPE_H
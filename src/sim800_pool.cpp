@@ -0,0 +1,172 @@
+#include <Arduino.h>
+#include "sim800_pool.h"
+
+sim800_pool::sim800_pool()
+{
+	memset(_members, 0, sizeof(_members));
+}
+
+bool sim800_pool::add(sim800 &modem)
+{
+	if(_count == SIM800_POOL_MAX) return false;
+	portENTER_CRITICAL(&_mux);
+	member &m = _members[_count];
+	m.modem = &modem;
+	m.stats.up = true;
+	_count++;
+	portEXIT_CRITICAL(&_mux);
+	return true;
+}
+
+uint8_t sim800_pool::size()
+{
+	return _count;
+}
+
+uint8_t sim800_pool::up()
+{
+	uint8_t n = 0;
+	for(uint8_t i = 0; i < _count; i++) if(_members[i].stats.up) n++;
+	return n;
+}
+
+// local errors from before the body went out, see HTTP_post_begin()
+static bool unsent(unsigned short int status)
+{
+	return status == 1000 || status == 1003 || status == 1101 || status == 1102 || status == 1110;
+}
+
+// an HTTP status from the server means the modem did its part
+unsigned short int sim800_pool::HTTP_post(const char *url, unsigned long int *length, char *buffer, uint32_t size)
+{
+	unsigned short int status = 1008;// no modem up
+	uint8_t tried = 0;
+	int8_t i;
+	while((i = pick(tried)) >= 0)
+	{
+		if(tried) failover();
+		tried |= 1 << i;
+		sim800 &modem = *_members[i].modem;
+		bool ok = false, online = true;
+		status = 1000;
+		if(modem.lock())
+		{
+			status = modem.HTTP_post(url, length, buffer, size);
+			ok = status >= 100 && status < 600;
+			if(!ok) online = modem.online();
+			modem.unlock();
+		}
+		done(i, ok, online, ok ? size : 0);
+		if(ok || !(at_least_once || unsent(status))) break;
+	}
+	return status;
+}
+
+bool sim800_pool::send(const char *host, unsigned short int port, char *buffer, size_t size, unsigned long int &accepted)
+{
+	uint8_t tried = 0;
+	int8_t i;
+	while((i = pick(tried)) >= 0)
+	{
+		if(tried) failover();
+		tried |= 1 << i;
+		sim800 &modem = *_members[i].modem;
+		bool ok = false, connected = false, online = true;
+		accepted = 0;
+		if(modem.lock())
+		{
+			connected = modem.connect(host, port);
+			ok = connected && modem.send(buffer, size, accepted) && accepted == size;
+			modem.disconnect();
+			if(!ok) online = modem.online();
+			modem.unlock();
+		}
+		done(i, ok, online, accepted);
+		if(ok) return true;
+		if(connected && !at_least_once) break;// some of it may have reached the peer
+	}
+	return false;
+}
+
+void sim800_pool::maintain(uint32_t timeout)
+{
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		if(_members[i].stats.up) continue;
+		sim800 &modem = *_members[i].modem;
+		bool ok = false;
+		if(modem.lock())
+		{
+			ok = modem.recover(timeout);
+			modem.unlock();
+		}
+		if(!ok) continue;
+		portENTER_CRITICAL(&_mux);
+		_members[i].stats.up = true;
+		portEXIT_CRITICAL(&_mux);
+	}
+}
+
+void sim800_pool::report(uint8_t index, sim800_pool_stats &out)
+{
+	if(index >= _count) return;
+	sim800_recovery recovery;
+	_members[index].modem->recovery_report(recovery);
+	portENTER_CRITICAL(&_mux);
+	memcpy(&out, &_members[index].stats, sizeof(out));
+	portEXIT_CRITICAL(&_mux);
+	out.health = recovery.health;
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+// the modem to use next, counted as busy until done()
+int8_t sim800_pool::pick(uint8_t tried)
+{
+	int8_t best = -1;
+	uint16_t best_score = 0xffff;
+	uint8_t health[SIM800_POOL_MAX];
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		sim800_recovery recovery;
+		_members[i].modem->recovery_report(recovery);
+		health[i] = recovery.health;
+	}
+	portENTER_CRITICAL(&_mux);
+	for(uint8_t i = 0; i < _count; i++)
+	{
+		const sim800_pool_stats &s = _members[i].stats;
+		if(!s.up || (tried & (1 << i))) continue;
+		uint16_t score = s.inflight * 100 + (100 - health[i]);
+		if(score < best_score)
+		{
+			best = i;
+			best_score = score;
+		}
+	}
+	if(best >= 0) _members[best].stats.inflight++;
+	portEXIT_CRITICAL(&_mux);
+	return best;
+}
+
+void sim800_pool::failover()
+{
+	portENTER_CRITICAL(&_mux);
+	failovers++;
+	portEXIT_CRITICAL(&_mux);
+}
+
+void sim800_pool::done(uint8_t index, bool ok, bool up, uint32_t bytes)
+{
+	portENTER_CRITICAL(&_mux);
+	sim800_pool_stats &s = _members[index].stats;
+	s.inflight--;
+	s.jobs++;
+	s.bytes += bytes;
+	if(!ok) s.failures++;
+	if(!up) s.up = false;
+	portEXIT_CRITICAL(&_mux);
+}
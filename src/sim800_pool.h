@@ -0,0 +1,65 @@
+#ifndef SIM800_POOL_H
+#define SIM800_POOL_H
+
+#include "sim800.h"
+
+#define SIM800_POOL_MAX 3
+/*how long maintain() spends on recover() for each modem that is down*/
+#define SIM800_POOL_RECOVERY 60000
+
+struct sim800_pool_stats
+{
+	bool up;
+	uint8_t health;
+	uint8_t inflight;
+	uint32_t jobs;
+	uint32_t failures;
+	uint32_t bytes;
+};
+
+/**
+* Spreads uploads over several modems, each on its own UART and pins
+* (see sim800_board). Every transfer goes to the modem that is up with
+* the fewest transfers in flight, ties go to the better recovery health
+* (sim800::recovery_report()). A modem whose transfer failed for a modem
+* reason (no HTTP status, 6xx or a local error) and whose bearer is gone
+* is taken out. The transfer is only repeated on the next modem when the
+* data never left: HTTP posts that failed before the body was sent
+* (1000, 1003, 1101, 1102, 1110) and sends that could not connect. With
+* at_least_once set every modem failure is repeated and the server has
+* to drop duplicates. maintain() brings modems that are down back with
+* sim800::recover(). All modems must be set up with gsm_init() before
+* they are added.
+*/
+class sim800_pool
+{
+public:
+	uint32_t failovers = 0;
+	bool at_least_once = false;
+
+	sim800_pool();
+	bool add(sim800 &modem);
+	uint8_t size();
+	uint8_t up();
+	unsigned short int HTTP_post(const char *url, unsigned long int *length, char *buffer, uint32_t size);
+	bool send(const char *host, unsigned short int port, char *buffer, size_t size, unsigned long int &accepted);
+	void maintain(uint32_t timeout = SIM800_POOL_RECOVERY);
+	void report(uint8_t index, sim800_pool_stats &out);
+
+protected:
+	struct member
+	{
+		sim800 *modem;
+		sim800_pool_stats stats;
+	};
+
+	member _members[SIM800_POOL_MAX];
+	uint8_t _count = 0;
+	portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+	int8_t pick(uint8_t tried);
+	void failover();
+	void done(uint8_t index, bool ok, bool up, uint32_t bytes);
+};
+
+#endif //SIM800_POOL_H
@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "sim800.h"
+#include "sim800_debug.h"
+
+#define sscanf_P(i, p, ...)    sscanf((i), (p), __VA_ARGS__)
+
+// the bearer is up if no deactivation was reported and it has an address
+bool sim800::online()
+{
+	hold h(*this);
+	const uint32_t deact = (1UL << URC_PDP_DEACT) | (1UL << URC_SAPBR_DEACT);
+	if(urc_pending & deact)
+	{
+		urc_pending &= ~deact;
+		return false;
+	}
+	uint16_t state = 0, ip0 = 0, ip1 = 0, ip2 = 0, ip3 = 0;
+	println(F("AT+SAPBR=2,1"));
+	char buf[SIM800_BUFSIZE];
+	expect_line(buf, SIM800_SERIAL_TIMEOUT);
+	bool ok = sscanf_P(buf, PSTR("+SAPBR: 1,%hu,\"%hu.%hu.%hu.%hu\""), &state, &ip0, &ip1, &ip2, &ip3) == 5;
+	ok = expect_OK() && ok;
+	return ok && state == 1 && (ip0 || ip1 || ip2 || ip3);
+}
+
+bool sim800::recover(uint32_t timeout)
+{
+	hold h(*this);
+	sim800_deadline deadline(timeout);
+	uint8_t tier = SIM800_TIER_BEARER, n = 0;
+	bool ok = false;
+	while(!deadline.expired())
+	{
+		_recovery.attempts[tier]++;
+		ok = recover_tier(tier);
+	#ifdef DEBUG_PROGRESS
+		PRINT("!!! SIM800 recovery tier ");
+		DEBUG(tier);
+		PRINT(ok ? " ok, health " : " failed, health ");
+		DEBUGLN(_recovery.health);
+	#endif
+		// health is an average over tier outcomes, a plain check counts too
+		_recovery.health = (_recovery.health * 3 + (ok ? 100 : 0)) / 4;
+		if(ok)
+		{
+			_recovery.fixed[tier]++;
+			_recovery.tier = tier;
+			break;
+		}
+		if(tier != SIM800_TIER_BEARER) pause(deadline.remaining(backoff(n++)));
+		if(tier < SIM800_TIER_POWER) tier++;
+		if(tier == SIM800_TIER_SAPBR && _recovery.health < SIM800_HEALTH_LOW && _recovery.tier > tier) tier = _recovery.tier;
+	}
+	if(ok) _recovery.recoveries++;
+	else _recovery.failures++;
+	_recovery.last_ms = millis() - deadline.start;
+	return ok;
+}
+
+void sim800::recovery_report(sim800_recovery &out)
+{
+	memcpy(&out, &_recovery, sizeof(_recovery));
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+// one recovery step, each tier redoes what the ones below it do
+bool sim800::recover_tier(uint8_t tier)
+{
+	switch(tier)
+	{
+		case SIM800_TIER_BEARER:
+			return online();
+		case SIM800_TIER_SAPBR:
+			expect_AT_OK(F("+SAPBR=0,1"), 10000);
+			break;
+		case SIM800_TIER_CGATT:
+			expect_AT_OK(F("+SAPBR=0,1"), 10000);
+			expect_AT_OK(F("+CGATT=0"), 10000);
+			if(!expect_AT_OK(F("+CGATT=1"), 10000)) return false;
+			break;
+		case SIM800_TIER_CFUN:
+			if(!radio_reset() || !registerNetwork()) return false;
+			break;
+		default:
+			power_off();
+			return gsm_init();
+	}
+	if(!set_bearer()) return false;
+	expect_AT_OK(F("+SAPBR=1,1"), SIM800_CMD_TIMEOUT);
+	return online();
+}
+
+// restart the radio without rebooting the modem
+bool sim800::radio_reset()
+{
+	expect_AT_OK(F("+CFUN=0"), 10000);
+	return expect_AT_OK(F("+CFUN=1"), 10000);
+}
+
+// a PWRKEY pulse of more than a second switches a running modem off
+void sim800::power_off()
+{
+	pinMode(_board.ps, INPUT);
+	if(digitalRead(_board.ps) == LOW) return;
+	pinMode(_board.key, OUTPUT);
+	digitalWrite(_board.key, LOW);
+	pause(1100);
+	digitalWrite(_board.key, HIGH);
+	pinMode(_board.key, INPUT_PULLUP);
+	wait_pin(_board.ps, LOW, SIM800_PWRKEY_TIMEOUT);
+}
+
+// exponential backoff with equal jitter: half of it fixed, half random
+uint32_t sim800::backoff(uint8_t attempt)
+{
+	uint32_t ms = SIM800_BACKOFF_MAX;
+	if(attempt < 16) ms = min((uint32_t) SIM800_BACKOFF_BASE << attempt, (uint32_t) SIM800_BACKOFF_MAX);
+	ms = ms / 2 + random(ms / 2 + 1);
+	_recovery.backoff_ms += ms;
+	return ms;
+}
@@ -0,0 +1,98 @@
+#include <Arduino.h>
+#include "sim800.h"
+
+// the bearer state is taken along so wake() knows what to check
+bool sim800::sleep(uint8_t mode)
+{
+	hold h(*this);
+	if(mode == SIM800_SLEEP_AUTO) mode = _board.dtr >= 0 ? SIM800_SLEEP_DTR : SIM800_SLEEP_AT;
+	if(mode == SIM800_SLEEP_DTR && _board.dtr < 0) return false;
+	if(_asleep) return _sleep_mode == mode;
+	_sleep_bearer = online();
+	if(mode != _sleep_mode)// DTR mode stays configured across wakes
+	{
+		if(_board.ri >= 0) expect_AT_OK(F("+CFGRI=1"));// RI pulses on URCs too
+		bool ok = mode == SIM800_SLEEP_DTR ? expect_AT_OK(F("+CSCLK=1")) : expect_AT_OK(F("+CSCLK=2"));
+		if(!ok) return false;
+		_sleep_mode = mode;
+	}
+	command_end();
+	_ri_pending = false;
+	if(mode == SIM800_SLEEP_DTR) digitalWrite(_board.dtr, HIGH);
+	_sleep_start = millis();
+	_asleep = true;
+	_sleep_stats.sleeps++;
+	return true;
+}
+
+bool sim800::wake()
+{
+	hold h(*this);
+	if(!_asleep) return true;
+	_asleep = false;
+	uint32_t start = millis();
+	_sleep_stats.asleep_ms += start - _sleep_start;
+	if(_sleep_mode == SIM800_SLEEP_DTR)
+	{
+		digitalWrite(_board.dtr, LOW);
+		pause(SIM800_DTR_SETTLE);
+	}
+	sim800_deadline deadline(SIM800_WAKE_TIMEOUT);
+	bool ok = false;
+	while(!ok && !deadline.expired())// in AT mode the first line is lost waking the UART
+	{
+		ok = expect_AT_OK(F(""), deadline.remaining(SIM800_POLL_INTERVAL));
+	}
+	uint32_t ms = millis() - start;
+	if(ok && _sleep_mode == SIM800_SLEEP_AT)
+	{
+		ok = expect_AT_OK(F("+CSCLK=0"));// awake until the next sleep()
+		if(ok) _sleep_mode = 0;
+	}
+	if(!ok)
+	{
+		_sleep_stats.failed++;
+		return false;
+	}
+	_sleep_stats.wakes++;
+	_sleep_stats.last_wake_ms = ms;
+	_sleep_stats.total_wake_ms += ms;
+	if(ms > _sleep_stats.max_wake_ms) _sleep_stats.max_wake_ms = ms;
+	if(_sleep_bearer && !online())
+	{
+		_sleep_stats.bearer_lost++;
+		return false;
+	}
+	return true;
+}
+
+bool sim800::sleeping()
+{
+	return _asleep;
+}
+
+// RI fell or the modem sent something while sleeping
+bool sim800::sleep_poll()
+{
+	hold h(*this);
+	if(!_asleep || !(_ri_pending || _serial.available())) return false;
+	_sleep_stats.ri_wakes++;
+	wake();
+	return true;
+}
+
+void sim800::sleep_report(sim800_sleep_stats &out)
+{
+	memcpy(&out, &_sleep_stats, sizeof(out));
+	if(_asleep) out.asleep_ms += millis() - _sleep_start;
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+void IRAM_ATTR sim800::ri_isr(void *arg)
+{
+	((sim800 *) arg)->_ri_pending = true;
+}
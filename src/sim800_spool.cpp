@@ -0,0 +1,279 @@
+#include <Arduino.h>
+#include "sim800_spool.h"
+#include "sim800_debug.h"
+
+#define SLOTS_PER_SECTOR (SIM800_SPOOL_SECTOR / SIM800_SPOOL_RECORD)
+
+static_assert(sizeof(sim800_spool_record) == SIM800_SPOOL_RECORD, "sim800_spool_record must fill a slot");
+
+sim800_spool::sim800_spool()
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+// find the newest record, the last commit and the oldest unsent record
+bool sim800_spool::begin(const char *label)
+{
+	_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+	if(!_partition) return false;
+	if(!_lock) _lock = xSemaphoreCreateMutex();
+	if(!_lock) return false;
+	_slots = _partition->size / SIM800_SPOOL_SECTOR * SLOTS_PER_SECTOR;
+	if(_slots < 2 * SLOTS_PER_SECTOR) return false;
+	sim800_spool_record r;
+	uint32_t newest = 0;
+	_head = 0;
+	_committed = 0;
+	for(uint32_t slot = 0; slot < _slots; slot++)
+	{
+		if(!read_slot(slot, r)) continue;
+		if(r.seq >= newest)
+		{
+			newest = r.seq;
+			_head = next(slot);
+		}
+		if(r.type == SIM800_SPOOL_COMMIT)
+		{
+			uint32_t seq;
+			memcpy(&seq, r.data, sizeof(seq));
+			if(seq > _committed) _committed = seq;
+		}
+	}
+	_seq = newest + 1;
+	// the ring runs from the head onwards, the first unsent record is the tail
+	_tail = _head;
+	_stats.backlog = 0;
+	bool found = false;
+	for(uint32_t i = 0, slot = _head; i < _slots; i++, slot = next(slot))
+	{
+		if(!read_slot(slot, r) || r.type != SIM800_SPOOL_DATA || r.seq <= _committed) continue;
+		if(!found) _tail = slot;
+		found = true;
+		_stats.backlog++;
+	}
+#ifdef DEBUG_PROGRESS
+	PRINT("!!! SIM800 spool backlog ");
+	DEBUGLN(_stats.backlog);
+#endif
+	return true;
+}
+
+bool sim800_spool::append(const uint8_t *data, size_t len)
+{
+	if(!_partition || len > SIM800_SPOOL_PAYLOAD) return false;
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	bool ok = write_record(SIM800_SPOOL_DATA, data, len);
+	if(ok)
+	{
+		_stats.appended++;
+		_stats.backlog++;
+	}
+	else _stats.dropped++;
+	xSemaphoreGive(_lock);
+	return ok;
+}
+
+// 0 if there was nothing to send, the HTTP status or a local error otherwise
+unsigned short int sim800_spool::flush(sim800 &modem, const char *url, uint32_t max)
+{
+	if(!_partition) return 1000;
+	sim800_spool_record r;
+	uint32_t size = 0, count = 0, last = 0, end = _tail, n;
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	uint32_t slots = span();
+	for(n = 0; n < slots; n++, end = next(end))
+	{
+		if(!read_slot(end, r) || r.type != SIM800_SPOOL_DATA || r.seq <= _committed) continue;
+		if(size + 1 + r.len > max) break;
+		size += 1 + r.len;
+		count++;
+		last = r.seq;
+	}
+	_flushing = count > 0;
+	_batch_slots = n;
+	uint32_t start = _tail;
+	xSemaphoreGive(_lock);
+	if(!count) return 0;
+	modem.link_sample();
+	if(!modem.link_bulk_ok(_deferred ? millis() - _deferred : 0))
+	{
+		xSemaphoreTake(_lock, portMAX_DELAY);
+		_flushing = false;
+		if(!_deferred) _deferred = millis() | 1;
+		_stats.deferred++;
+		xSemaphoreGive(_lock);
+		return 1010;
+	}
+	_deferred = 0;
+
+	uint32_t started = millis();
+	unsigned long int length = 0;
+	reader body(*this, start, n);
+	unsigned short int status = modem.HTTP_post(url, length, body, size);
+
+	xSemaphoreTake(_lock, portMAX_DELAY);
+	_flushing = false;
+	// the batch is out of the backlog before the commit record may open a sector
+	uint32_t tail = _tail, backlog = _stats.backlog;
+	bool ok = status >= 200 && status < 300;
+	if(ok)
+	{
+		_tail = end;
+		_stats.backlog -= count < backlog ? count : backlog;
+		ok = write_record(SIM800_SPOOL_COMMIT, (const uint8_t *) &last, sizeof(last));
+		if(!ok)
+		{
+			_tail = tail;
+			_stats.backlog = backlog;
+		}
+	}
+	if(ok)
+	{
+		_committed = last;
+		_stats.flushed += count;
+		_stats.flushed_bytes += size;
+		_stats.batches++;
+		_stats.last_flush_ms = millis() - started;
+		_stats.last_flush_bytes = size;
+	}
+	else _stats.failures++;
+	xSemaphoreGive(_lock);
+	return status;
+}
+
+uint32_t sim800_spool::backlog()
+{
+	return _stats.backlog;
+}
+
+void sim800_spool::report(sim800_spool_stats &out)
+{
+	if(_lock) xSemaphoreTake(_lock, portMAX_DELAY);
+	memcpy(&out, &_stats, sizeof(out));
+	if(_lock) xSemaphoreGive(_lock);
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+// CRC-16/CCITT over everything but the crc field itself
+uint16_t sim800_spool::crc(const sim800_spool_record &r)
+{
+	uint16_t crc = 0xffff;
+	const uint8_t *p = (const uint8_t *) &r;
+	size_t len = offsetof(sim800_spool_record, data) + (r.len <= SIM800_SPOOL_PAYLOAD ? r.len : 0);
+	for(size_t i = 0; i < len; i++)
+	{
+		if(i == offsetof(sim800_spool_record, crc)) i = offsetof(sim800_spool_record, data);
+		crc ^= (uint16_t) p[i] << 8;
+		for(uint8_t b = 0; b < 8; b++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+// a torn or blank slot does not count as a record
+bool sim800_spool::read_slot(uint32_t slot, sim800_spool_record &r)
+{
+	if(esp_partition_read(_partition, slot * SIM800_SPOOL_RECORD, &r, sizeof(r)) != ESP_OK) return false;
+	if(r.seq == 0xffffffff || r.len > SIM800_SPOOL_PAYLOAD) return false;
+	return r.crc == crc(r);
+}
+
+bool sim800_spool::write_record(uint8_t type, const uint8_t *data, uint8_t len)
+{
+	sim800_spool_record r;
+	uint32_t blank;
+	// skip slots a power loss left half written
+	for(uint8_t tries = 0; tries < SLOTS_PER_SECTOR; tries++)
+	{
+		if(_head % SLOTS_PER_SECTOR == 0 && !open_sector(_head)) return false;
+		if(esp_partition_read(_partition, _head * SIM800_SPOOL_RECORD, &blank, sizeof(blank)) == ESP_OK && blank == 0xffffffff) break;
+		_head = next(_head);
+	}
+	memset(&r, 0xff, sizeof(r));
+	r.seq = _seq;
+	r.type = type;
+	r.len = len;
+	memcpy(r.data, data, len);
+	r.crc = crc(r);
+	if(esp_partition_write(_partition, _head * SIM800_SPOOL_RECORD, &r, offsetof(sim800_spool_record, data) + len) != ESP_OK) return false;
+	_seq++;
+	_head = next(_head);
+	return true;
+}
+
+// erase the sector the head enters, unsent records in it are lost unless
+// a flush is reading them, then the new record is refused instead
+bool sim800_spool::open_sector(uint32_t slot)
+{
+	uint32_t first = slot, last = slot + SLOTS_PER_SECTOR;
+	sim800_spool_record r;
+	if(_flushing)
+	{
+		for(uint32_t i = 0, s = _tail; i < _batch_slots; i++, s = next(s)) if(s >= first && s < last) return false;
+	}
+	if(_tail >= first && _tail < last && _stats.backlog)
+	{
+		for(uint32_t s = _tail; s < last; s++)
+		{
+			if(!read_slot(s, r) || r.type != SIM800_SPOOL_DATA || r.seq <= _committed) continue;
+			_stats.dropped++;
+			if(_stats.backlog) _stats.backlog--;
+		}
+		_tail = next(last - 1);
+	}
+	return esp_partition_erase_range(_partition, first * SIM800_SPOOL_RECORD, SIM800_SPOOL_SECTOR) == ESP_OK;
+}
+
+uint32_t sim800_spool::next(uint32_t slot)
+{
+	return slot + 1 < _slots ? slot + 1 : 0;
+}
+
+// slots from the tail up to the head, all of them when a refused sector
+// left the head on the tail of a full ring
+uint32_t sim800_spool::span()
+{
+	uint32_t n = (_head + _slots - _tail) % _slots;
+	return n || !_stats.backlog ? n : _slots;
+}
+
+sim800_spool::reader::reader(sim800_spool &spool, uint32_t slot, uint32_t slots) : _spool(spool), _slot(slot), _left(slots)
+{
+}
+
+// move to the next unsent data record of the batch, _pos 0 is its length byte
+bool sim800_spool::reader::load()
+{
+	while(!_loaded || _pos > _record.len)
+	{
+		if(!_left) return false;
+		uint32_t slot = _slot;
+		_slot = _spool.next(_slot);
+		_left--;
+		_pos = 0;
+		_loaded = _spool.read_slot(slot, _record) && _record.type == SIM800_SPOOL_DATA && _record.seq > _spool._committed;
+	}
+	return true;
+}
+
+int sim800_spool::reader::available()
+{
+	return load() ? _record.len + 1 - _pos : 0;
+}
+
+int sim800_spool::reader::read()
+{
+	if(!load()) return -1;
+	uint8_t c = _pos ? _record.data[_pos - 1] : _record.len;
+	_pos++;
+	return c;
+}
+
+int sim800_spool::reader::peek()
+{
+	if(!load()) return -1;
+	return _pos ? _record.data[_pos - 1] : _record.len;
+}
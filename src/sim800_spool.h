@@ -0,0 +1,108 @@
+#ifndef SIM800_SPOOL_H
+#define SIM800_SPOOL_H
+
+#include "sim800.h"
+#include "esp_partition.h"
+
+/*data partition holding the spool, by label*/
+#ifndef SIM800_SPOOL_LABEL
+#define SIM800_SPOOL_LABEL "spool"
+#endif
+#define SIM800_SPOOL_SECTOR 4096
+#define SIM800_SPOOL_RECORD 64
+#define SIM800_SPOOL_PAYLOAD (SIM800_SPOOL_RECORD - 8)
+/*upper bound for the body of one flush() post*/
+#ifndef SIM800_SPOOL_BATCH
+#define SIM800_SPOOL_BATCH 16384
+#endif
+#define SIM800_SPOOL_DATA 1
+#define SIM800_SPOOL_COMMIT 2
+
+/*one flash slot, a blank slot reads all 0xff*/
+struct sim800_spool_record
+{
+	uint32_t seq;
+	uint8_t type;
+	uint8_t len;
+	uint16_t crc;
+	uint8_t data[SIM800_SPOOL_PAYLOAD];
+};
+
+struct sim800_spool_stats
+{
+	uint32_t backlog;
+	uint32_t appended;
+	uint32_t dropped;
+	uint32_t flushed;
+	uint32_t flushed_bytes;
+	uint32_t batches;
+	uint32_t failures;
+	uint32_t last_flush_ms;
+	uint32_t last_flush_bytes;
+	uint32_t deferred;
+};
+
+/**
+* Persistent store-and-forward queue in a flash partition. Readings are
+* appended as fixed-size records with a sequence number and CRC into a
+* ring of sectors, each written once; a sector is erased when the ring
+* comes back to it, dropping what was still unsent there. flush() posts
+* the oldest unsent records back to back as one body through
+* HTTP_post(Stream), each as a length byte followed by its payload, and
+* appends a commit record only after a 2xx answer, so a power loss at any
+* point resends at most one batch.
+* begin() rebuilds the state by scanning the partition. While the link
+* is too weak for bulk work flush() returns 1010 and sends nothing.
+*/
+class sim800_spool
+{
+public:
+	sim800_spool();
+	bool begin(const char *label = SIM800_SPOOL_LABEL);
+	bool append(const uint8_t *data, size_t len);
+	unsigned short int flush(sim800 &modem, const char *url, uint32_t max = SIM800_SPOOL_BATCH);
+	uint32_t backlog();
+	void report(sim800_spool_stats &out);
+
+protected:
+	/*streams a batch of records to HTTP_post, a length byte before each payload*/
+	class reader : public Stream
+	{
+	public:
+		reader(sim800_spool &spool, uint32_t slot, uint32_t slots);
+		int available();
+		int read();
+		int peek();
+		void flush() {}
+		size_t write(uint8_t) { return 0; }
+	protected:
+		sim800_spool &_spool;
+		uint32_t _slot;
+		uint32_t _left;
+		sim800_spool_record _record;
+		bool _loaded = false;
+		uint8_t _pos = 0;
+		bool load();
+	};
+
+	const esp_partition_t *_partition = NULL;
+	SemaphoreHandle_t _lock = NULL;
+	uint32_t _slots = 0;
+	uint32_t _head = 0;
+	uint32_t _tail = 0;
+	uint32_t _seq = 1;
+	uint32_t _committed = 0;
+	bool _flushing = false;
+	uint32_t _batch_slots = 0;
+	uint32_t _deferred = 0;
+	sim800_spool_stats _stats;
+
+	static uint16_t crc(const sim800_spool_record &r);
+	bool read_slot(uint32_t slot, sim800_spool_record &r);
+	bool write_record(uint8_t type, const uint8_t *data, uint8_t len);
+	bool open_sector(uint32_t slot);
+	uint32_t next(uint32_t slot);
+	uint32_t span();
+};
+
+#endif //SIM800_SPOOL_H
@@ -0,0 +1,191 @@
+#include <Arduino.h>
+#include "sim800.h"
+#include "sim800_debug.h"
+
+#define sscanf_P(i, p, ...)    sscanf((i), (p), __VA_ARGS__)
+
+bool sim800::status_signal(sim800_signal &out)
+{
+	return snapshot(_status_signal, out);
+}
+
+bool sim800::status_battery(sim800_battery &out)
+{
+	return snapshot(_status_battery, out);
+}
+
+bool sim800::status_clock(sim800_clock &out)
+{
+	return snapshot(_status_clock, out);
+}
+
+bool sim800::status_registration(sim800_registration &out)
+{
+	return snapshot(_status_registration, out);
+}
+
+bool sim800::status_location(sim800_location &out)
+{
+	return snapshot(_status_location, out);
+}
+
+void sim800::status_ttl(uint8_t item, uint32_t ttl)
+{
+	switch(item)
+	{
+		case SIM800_STATUS_SIGNAL: _status_signal.ttl = ttl; break;
+		case SIM800_STATUS_BATTERY: _status_battery.ttl = ttl; break;
+		case SIM800_STATUS_CLOCK: _status_clock.ttl = ttl; break;
+		case SIM800_STATUS_REGISTRATION: _status_registration.ttl = ttl; break;
+		case SIM800_STATUS_LOCATION: _status_location.ttl = ttl; break;
+	}
+}
+
+// refresh whatever has expired, one AT round trip per value, the UART
+// is only held for a single query and its store at a time; a sleeping
+// modem is left alone unless RI or a URC woke it
+void sim800::status_refresh(bool force)
+{
+	if(_asleep)
+	{
+		hold h(*this);
+		sleep_poll();
+	}
+	if(_asleep) return;
+	if(_clock_urc_pending)
+	{
+		hold h(*this);
+		store(_status_clock, _clock_urc);
+		_clock_urc_pending = false;
+	}
+	uint32_t now = millis();
+	if(force || !_status_signal.updated || now - _status_signal.updated >= _status_signal.ttl)
+	{
+		hold h(*this);
+		sim800_signal v = {0, 99};
+		println(F("AT+CSQ"));
+		if(expect_scan(F("+CSQ: %d,%d"), &v.rssi, &v.ber) && expect_OK())
+		{
+			store(_status_signal, v);
+			gsm_rssi = v.rssi;
+			gsm_ber = v.ber;
+		}
+	}
+	if(force || !_status_registration.updated || now - _status_registration.updated >= _status_registration.ttl)
+	{
+		hold h(*this);
+		sim800_registration v = {0};
+		if(registration(v.stat)) store(_status_registration, v);
+	}
+	if(force || !_status_battery.updated || now - _status_battery.updated >= _status_battery.ttl)
+	{
+		hold h(*this);
+		sim800_battery v = {0, 0, 0};
+		println(F("AT+CBC"));
+		if(expect_scan(F("+CBC: %hu,%hu,%hu"), &v.status, &v.percent, &v.voltage) && expect_OK()) store(_status_battery, v);
+	}
+	if(force || !_status_clock.updated || now - _status_clock.updated >= _status_clock.ttl)
+	{
+		hold h(*this);
+		sim800_clock v;
+		if(time(v.date, v.time, v.tz)) store(_status_clock, v);
+	}
+	if(force || !_status_location.updated || now - _status_location.updated >= _status_location.ttl)
+	{
+		hold h(*this);
+		sim800_location v;
+		if(location(v)) store(_status_location, v);
+	}
+}
+
+bool sim800::status_start(uint32_t period, bool network_time)
+{
+	if(_status_task) return true;
+	if(network_time)
+	{
+		expect_AT_OK(F("+CLTS=1"));// *PSUTTZ and +CTZV keep the clock fresh for free
+	}
+	if(!_status_done) _status_done = xSemaphoreCreateBinary();
+	if(!_status_done) return false;
+	_status_period = period;
+	_status_running = true;
+	if(xTaskCreate(status_task, "sim800_status", SIM800_STATUS_STACK, this, 1, &_status_task) != pdPASS)
+	{
+		_status_running = false;
+		_status_task = NULL;
+		return false;
+	}
+	return true;
+}
+
+// the handle is only cleared under the lock, so the task is still there
+// when it is notified
+void sim800::status_stop()
+{
+	TaskHandle_t task;
+	{
+		hold h(*this);
+		task = _status_task;
+		_status_running = false;
+		if(task) xTaskNotifyGive(task);
+	}
+	if(task) xSemaphoreTake(_status_done, portMAX_DELAY);
+}
+
+void sim800::status_task(void *arg)
+{
+	sim800 *modem = (sim800 *) arg;
+	while(modem->_status_running)
+	{
+		modem->status_refresh();
+		ulTaskNotifyTake(pdTRUE, modem->_status_period / portTICK_RATE_MS);
+	}
+	modem->lock();
+	modem->_status_task = NULL;
+	modem->unlock();
+	xSemaphoreGive(modem->_status_done);
+	vTaskDelete(NULL);
+}
+
+// serialize access to the UART between tasks, the mutex is made by the constructor
+bool sim800::lock(uint32_t timeout)
+{
+	if(!_lock) return false;
+	return xSemaphoreTakeRecursive(_lock, timeout == portMAX_DELAY ? portMAX_DELAY : timeout / portTICK_RATE_MS) == pdTRUE;
+}
+
+void sim800::unlock()
+{
+	if(_lock) xSemaphoreGiveRecursive(_lock);
+}
+
+// *PSUTTZ: 2017,4,20,12,5,30,"+8",0
+// +CTZV: +8,0
+// runs in whichever task reads the UART, the clock is only stashed here
+// and stored by status_refresh()
+void sim800::status_urc(uint8_t urc, const char *line)
+{
+	sim800_clock v;
+	if(_clock_urc_pending) v = _clock_urc;
+	else snapshot(_status_clock, v);
+	int tz = 0;
+	if(urc == URC_PSUTTZ)
+	{
+		unsigned int year, month, day, hour, minute, second;
+		if(sscanf_P(line, PSTR("*PSUTTZ: %u,%u,%u,%u,%u,%u,\"%d\""), &year, &month, &day, &hour, &minute, &second, &tz) != 7) return;
+		snprintf(v.date, sizeof(v.date), "%02u/%02u/%02u", year % 100, month % 100, day % 100);
+		snprintf(v.time, sizeof(v.time), "%02u:%02u:%02u", hour % 100, minute % 100, second % 100);
+	}
+	else
+	{
+		if(sscanf_P(line, PSTR("+CTZV: %d"), &tz) != 1) return;
+		if(!_clock_urc_pending && !_status_clock.updated) return;// a timezone alone is no clock
+	}
+	snprintf(v.tz, sizeof(v.tz), "%+03d", tz % 100);
+	_clock_urc = v;
+	_clock_urc_pending = true;
+#ifdef DEBUG_URC
+	PRINT("!!! SIM800 clock ");
+	DEBUGLN(v.time);
+#endif
+}
@@ -0,0 +1,151 @@
+#include <Arduino.h>
+#include "sim800.h"
+
+#ifdef SIM800_TRACE
+// bytes of the same direction are packed into one chunk as long as they
+// arrive within 255 ms of its start, otherwise the oldest chunk is reused
+void sim800::trace(uint8_t dir, const uint8_t *data, size_t len)
+{
+	uint32_t now = millis();
+	while(len--)
+	{
+		sim800_trace_chunk *c = &_trace[_trace_head];
+		if(!_trace_count || c->dir != dir || c->len == SIM800_TRACE_DATA || now - c->ms > 255)
+		{
+			if(_trace_count) _trace_head = (_trace_head + 1) % SIM800_TRACE_CHUNKS;
+			if(_trace_count < SIM800_TRACE_CHUNKS) _trace_count++;
+			c = &_trace[_trace_head];
+			c->ms = now;
+			c->dir = dir;
+			c->len = 0;
+		}
+		c->data[c->len++] = *data++;
+	}
+}
+
+size_t sim800::trace_dump(Stream &out)
+{
+	hold h(*this);
+	sim800_trace_header header = {SIM800_TRACE_MAGIC, SIM800_TRACE_VERSION, sizeof(sim800_trace_chunk), _trace_count};
+	size_t n = out.write((const uint8_t *) &header, sizeof(header));
+	uint32_t first = (_trace_head + SIM800_TRACE_CHUNKS + 1 - _trace_count) % SIM800_TRACE_CHUNKS;
+	for(uint32_t i = 0; i < _trace_count; i++)
+	{
+		n += out.write((const uint8_t *) &_trace[(first + i) % SIM800_TRACE_CHUNKS], sizeof(sim800_trace_chunk));
+	}
+	return n;
+}
+
+void sim800::trace_clear()
+{
+	hold h(*this);
+	_trace_head = 0;
+	_trace_count = 0;
+}
+#endif
+
+sim800_replay::sim800_replay(int) {}
+
+bool sim800_replay::load(const sim800_trace_chunk *chunks, uint32_t count, float speed)
+{
+	_chunks = chunks;
+	_count = count;
+	_chunk = 0;
+	_pos = 0;
+	_speed = speed;
+	_anchor = millis();
+	_anchor_ms = count ? chunks[0].ms : 0;
+	mismatches = 0;
+	return count > 0;
+}
+
+// read a dump written by sim800::trace_dump() into caller memory
+bool sim800_replay::load(Stream &dump, sim800_trace_chunk *chunks, uint32_t max, float speed)
+{
+	sim800_trace_header header;
+	if(dump.readBytes((char *) &header, sizeof(header)) != sizeof(header)) return false;
+	if(header.magic != SIM800_TRACE_MAGIC || header.version != SIM800_TRACE_VERSION || header.chunk_size != sizeof(sim800_trace_chunk)) return false;
+	uint32_t count = min(header.count, max);
+	size_t len = count * sizeof(sim800_trace_chunk);
+	if(dump.readBytes((char *) chunks, len) != len) return false;
+	return load(chunks, count, speed);
+}
+
+bool sim800_replay::done()
+{
+	return _chunk >= _count;
+}
+
+bool sim800_replay::rx_pending()
+{
+	return _chunk < _count && _chunks[_chunk].dir == SIM800_TRACE_RX;
+}
+
+const sim800_trace_chunk *sim800_replay::chunk(uint32_t i)
+{
+	return i < _count ? &_chunks[i] : NULL;
+}
+
+void sim800_replay::begin(unsigned long, uint32_t, int8_t, int8_t) {}
+
+// an RX chunk is due once its original delay after the start of the last
+// TX chunk has passed, the recorded timestamps are both taken at first bytes
+bool sim800_replay::ready()
+{
+	if(_chunk >= _count || _chunks[_chunk].dir != SIM800_TRACE_RX) return false;
+	if(_speed <= 0) return true;
+	return (millis() - _anchor) * _speed >= _chunks[_chunk].ms - _anchor_ms;
+}
+
+void sim800_replay::next()
+{
+	_chunk++;
+	_pos = 0;
+}
+
+int sim800_replay::available()
+{
+	if(!ready()) return 0;
+	return _chunks[_chunk].len - _pos;
+}
+
+int sim800_replay::read()
+{
+	if(!ready()) return -1;
+	int c = _chunks[_chunk].data[_pos++];
+	if(_pos == _chunks[_chunk].len) next();
+	return c;
+}
+
+int sim800_replay::peek()
+{
+	if(!ready()) return -1;
+	return _chunks[_chunk].data[_pos];
+}
+
+void sim800_replay::flush() {}
+
+// writes walk through the recorded TX chunks, the modem answer is timed
+// from the moment the library started sending the chunk before it
+size_t sim800_replay::write(uint8_t c)
+{
+	if(_chunk >= _count || _chunks[_chunk].dir != SIM800_TRACE_TX)
+	{
+		mismatches++;
+		return 1;
+	}
+	if(!_pos)
+	{
+		_anchor = millis();
+		_anchor_ms = _chunks[_chunk].ms;
+	}
+	if(_chunks[_chunk].data[_pos++] != c) mismatches++;
+	if(_pos == _chunks[_chunk].len) next();
+	return 1;
+}
+
+size_t sim800_replay::write(const uint8_t *buffer, size_t size)
+{
+	for(size_t i = 0; i < size; i++) write(buffer[i]);
+	return size;
+}
@@ -0,0 +1,79 @@
+#ifndef SIM800_TRACE_H
+#define SIM800_TRACE_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <Stream.h>
+
+/*ring of SIM800_TRACE_CHUNKS chunks, each holding up to SIM800_TRACE_DATA bytes*/
+#ifndef SIM800_TRACE_CHUNKS
+#define SIM800_TRACE_CHUNKS 256
+#endif
+#define SIM800_TRACE_DATA 26
+#define SIM800_TRACE_TX 0
+#define SIM800_TRACE_RX 1
+#define SIM800_TRACE_MAGIC 0x52543853 // "S8TR"
+#define SIM800_TRACE_VERSION 1
+
+/*consecutive bytes in one direction, ms is when the first one was seen*/
+struct sim800_trace_chunk
+{
+	uint32_t ms;
+	uint8_t dir;
+	uint8_t len;
+	uint8_t data[SIM800_TRACE_DATA];
+};
+
+/*a dump is this header followed by count chunks, oldest first*/
+struct sim800_trace_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t chunk_size;
+	uint32_t count;
+};
+
+/**
+* Plays a recorded trace back as the modem UART. Build with SIM800_REPLAY
+* to make it the sim800 transport, sim800::replay() returns it. Received
+* bytes are released with the delay they originally had after the start
+* of the TX chunk before them, divided by speed (0 releases them
+* immediately). Written bytes are compared with the recording and
+* mismatches are counted. rx_pending() tells whether modem bytes come
+* next, chunk() gives the recording for a driver that re-issues it.
+*/
+class sim800_replay : public Stream
+{
+public:
+	uint32_t mismatches = 0;
+
+	sim800_replay(int uart = 0);
+	bool load(const sim800_trace_chunk *chunks, uint32_t count, float speed = 1.0);
+	bool load(Stream &dump, sim800_trace_chunk *chunks, uint32_t max, float speed = 1.0);
+	bool done();
+	bool rx_pending();
+	const sim800_trace_chunk *chunk(uint32_t i);
+	void begin(unsigned long baud, uint32_t config = 0, int8_t rx = -1, int8_t tx = -1);
+	void updateBaudRate(unsigned long) {}
+	void setRxBufferSize(size_t) {}
+	int available();
+	int read();
+	int peek();
+	void flush();
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *buffer, size_t size);
+	using Print::write;
+
+protected:
+	const sim800_trace_chunk *_chunks = NULL;
+	uint32_t _count = 0;
+	uint32_t _chunk = 0;
+	uint8_t _pos = 0;
+	float _speed = 1.0;
+	uint32_t _anchor = 0;
+	uint32_t _anchor_ms = 0;
+	bool ready();
+	void next();
+};
+
+#endif //SIM800_TRACE_H
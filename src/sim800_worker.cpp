@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include "sim800_worker.h"
+
+sim800_worker::sim800_worker(sim800 &modem) : _modem(modem)
+{
+	memset(_queue, 0, sizeof(_queue));
+	memset(_stats, 0, sizeof(_stats));
+}
+
+bool sim800_worker::start(uint32_t stack, UBaseType_t priority)
+{
+	if(_task) return true;
+	if(!_pending) _pending = xSemaphoreCreateBinary();
+	if(!_stopped) _stopped = xSemaphoreCreateBinary();
+	if(!_pending || !_stopped) return false;
+	for(uint8_t p = 0; p < SIM800_PRIORITIES; p++)
+	{
+		if(!_queue[p]) _queue[p] = xQueueCreate(SIM800_WORKER_QUEUE, sizeof(job));
+		if(!_queue[p]) return false;
+	}
+	_running = true;
+	if(xTaskCreate(task, "sim800_worker", stack, this, priority, &_task) != pdPASS)
+	{
+		_running = false;
+		_task = NULL;
+		return false;
+	}
+	return true;
+}
+
+// the task ends after the step it is running, then every job still
+// queued fails and its waiter is woken
+void sim800_worker::stop()
+{
+	if(!_task) return;
+	_running = false;
+	xSemaphoreGive(_pending);
+	xSemaphoreTake(_stopped, portMAX_DELAY);
+	job j;
+	for(uint8_t p = 0; p < SIM800_PRIORITIES; p++)
+	{
+		while(xQueueReceive(_queue[p], &j, 0) == pdTRUE) finish(j, SIM800_JOB_FAILED);
+	}
+}
+
+bool sim800_worker::run(uint8_t client, uint8_t priority, sim800_job_fn fn, void *arg)
+{
+	job j = {fn, arg, client, priority, (uint32_t) millis(), xTaskGetCurrentTaskHandle()};
+	if(!submit(j)) return false;
+	return ulTaskNotifyTake(pdTRUE, portMAX_DELAY) == SIM800_WORKER_OK;
+}
+
+bool sim800_worker::post(uint8_t client, uint8_t priority, sim800_job_fn fn, void *arg)
+{
+	job j = {fn, arg, client, priority, (uint32_t) millis(), NULL};
+	return submit(j);
+}
+
+uint8_t sim800_worker::pending()
+{
+	uint8_t n = 0;
+	for(uint8_t p = 0; p < SIM800_PRIORITIES; p++) if(_queue[p]) n += uxQueueMessagesWaiting(_queue[p]);
+	return n;
+}
+
+void sim800_worker::client_stats(uint8_t client, sim800_client_stats &out)
+{
+	if(client >= SIM800_WORKER_CLIENTS) return;
+	portENTER_CRITICAL(&_mux);
+	memcpy(&out, &_stats[client], sizeof(out));
+	portEXIT_CRITICAL(&_mux);
+}
+
+/* ===========================================================================
+ * PROTECTED
+ * ===========================================================================
+ */
+
+bool sim800_worker::submit(job &j)
+{
+	if(!_task || !_running || !j.fn || j.client >= SIM800_WORKER_CLIENTS || j.priority >= SIM800_PRIORITIES) return false;
+	if(xQueueSend(_queue[j.priority], &j, 0) != pdTRUE)
+	{
+		portENTER_CRITICAL(&_mux);
+		_stats[j.client].rejected++;
+		portEXIT_CRITICAL(&_mux);
+		return false;
+	}
+	xSemaphoreGive(_pending);
+	return true;
+}
+
+// the oldest job that waited past SIM800_WORKER_AGING, else by priority,
+// bulk jobs only when the link is good enough
+bool sim800_worker::next(job &j)
+{
+	uint32_t now = millis();
+	int8_t pick = -1;
+	uint32_t oldest = 0;
+	for(uint8_t p = 0; p < SIM800_PRIORITIES; p++)
+	{
+		if(xQueuePeek(_queue[p], &j, 0) != pdTRUE) continue;
+		if(p == SIM800_PRIO_BULK && !_modem.link_bulk_ok(now - j.queued)) continue;
+		if(pick < 0) pick = p;
+		if(now - j.queued >= SIM800_WORKER_AGING && now - j.queued > oldest)
+		{
+			oldest = now - j.queued;
+			pick = p;
+		}
+	}
+	return pick >= 0 && xQueueReceive(_queue[pick], &j, 0) == pdTRUE;
+}
+
+uint8_t sim800_worker::step(job &j)
+{
+	uint32_t start = millis();
+	uint8_t result = SIM800_JOB_FAILED;
+	if(_modem.lock())
+	{
+		result = j.fn(_modem, j.arg);
+		_modem.unlock();
+	}
+	uint32_t wait = start - j.queued, ran = millis() - start;
+	portENTER_CRITICAL(&_mux);
+	sim800_client_stats &s = _stats[j.client];
+	s.steps++;
+	s.wait_ms += wait;
+	if(wait > s.max_wait_ms) s.max_wait_ms = wait;
+	s.run_ms += ran;
+	if(result != SIM800_JOB_MORE) s.jobs++;
+	portEXIT_CRITICAL(&_mux);
+	return result;
+}
+
+void sim800_worker::finish(job &j, uint8_t result)
+{
+	if(result == SIM800_JOB_FAILED)
+	{
+		portENTER_CRITICAL(&_mux);
+		_stats[j.client].failed++;
+		portEXIT_CRITICAL(&_mux);
+	}
+	if(j.waiter) xTaskNotify(j.waiter, result == SIM800_JOB_DONE ? SIM800_WORKER_OK : SIM800_WORKER_FAILED, eSetValueWithOverwrite);
+}
+
+// sleeps on _pending until submit() or stop() gives it, only deferred
+// bulk jobs are looked at again after a poll interval
+void sim800_worker::task(void *arg)
+{
+	sim800_worker *worker = (sim800_worker *) arg;
+	job j;
+	while(worker->_running)
+	{
+		if(!worker->next(j))
+		{
+			xSemaphoreTake(worker->_pending, worker->pending() ? SIM800_POLL_INTERVAL / portTICK_RATE_MS : portMAX_DELAY);
+			continue;
+		}
+		uint8_t result = worker->step(j);
+		while(result == SIM800_JOB_MORE)// back to the end of its queue, or on right away if that is full
+		{
+			j.queued = millis();
+			if(xQueueSend(worker->_queue[j.priority], &j, 0) == pdTRUE) break;
+			result = worker->step(j);
+		}
+		if(result != SIM800_JOB_MORE) worker->finish(j, result);
+	}
+	worker->_task = NULL;
+	xSemaphoreGive(worker->_stopped);
+	vTaskDelete(NULL);
+}
@@ -0,0 +1,91 @@
+#ifndef SIM800_WORKER_H
+#define SIM800_WORKER_H
+
+#include "sim800.h"
+#include "freertos/queue.h"
+
+/*job priorities, lower runs first*/
+#define SIM800_PRIO_STATUS 0
+#define SIM800_PRIO_NORMAL 1
+#define SIM800_PRIO_BULK   2
+#define SIM800_PRIORITIES  3
+/*queued jobs per priority and client ids with their own statistics*/
+#define SIM800_WORKER_QUEUE 8
+#define SIM800_WORKER_CLIENTS 8
+#define SIM800_WORKER_STACK 4096
+#define SIM800_WORKER_PRIORITY 2
+/*a job waiting this long runs before jobs of higher priority*/
+#define SIM800_WORKER_AGING 5000
+
+/*what a job step returns: finished, queue it again for another step, or given up*/
+#define SIM800_JOB_DONE   0
+#define SIM800_JOB_MORE   1
+#define SIM800_JOB_FAILED 2
+/*task notification values run() waits for*/
+#define SIM800_WORKER_OK     1
+#define SIM800_WORKER_FAILED 2
+
+/*a unit of modem work, returns SIM800_JOB_DONE, SIM800_JOB_MORE or SIM800_JOB_FAILED*/
+typedef uint8_t (*sim800_job_fn)(sim800 &modem, void *arg);
+
+struct sim800_client_stats
+{
+	uint32_t jobs;
+	uint32_t steps;
+	uint32_t rejected;
+	uint32_t failed;
+	uint32_t wait_ms;
+	uint32_t max_wait_ms;
+	uint32_t run_ms;
+};
+
+/**
+* A task that owns the modem and runs jobs for several client tasks, one
+* step at a time, highest priority first and in order within a priority.
+* Long transfers are written as jobs that move one chunk per step, so
+* status queries get the UART between two chunks. Each step holds
+* sim800::lock(), which keeps the status task in line as well. Statistics
+* are kept per client id: queued time per step and modem time.
+*/
+class sim800_worker
+{
+public:
+	sim800_worker(sim800 &modem);
+	bool start(uint32_t stack = SIM800_WORKER_STACK, UBaseType_t priority = SIM800_WORKER_PRIORITY);
+	/*returns once the task has exited, jobs still queued fail*/
+	void stop();
+	/*queue a job and block until it is done, false if it failed or the worker stopped, never call it from a job*/
+	bool run(uint8_t client, uint8_t priority, sim800_job_fn fn, void *arg);
+	/*queue a job and return, arg must stay valid until it is done*/
+	bool post(uint8_t client, uint8_t priority, sim800_job_fn fn, void *arg);
+	uint8_t pending();
+	void client_stats(uint8_t client, sim800_client_stats &out);
+
+protected:
+	struct job
+	{
+		sim800_job_fn fn;
+		void *arg;
+		uint8_t client;
+		uint8_t priority;
+		uint32_t queued;
+		TaskHandle_t waiter;
+	};
+
+	sim800 &_modem;
+	QueueHandle_t _queue[SIM800_PRIORITIES];
+	SemaphoreHandle_t _pending = NULL;
+	SemaphoreHandle_t _stopped = NULL;
+	TaskHandle_t _task = NULL;
+	volatile bool _running = false;
+	portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+	sim800_client_stats _stats[SIM800_WORKER_CLIENTS];
+
+	bool submit(job &j);
+	bool next(job &j);
+	uint8_t step(job &j);
+	void finish(job &j, uint8_t result);
+	static void task(void *arg);
+};
+
+#endif //SIM800_WORKER_H
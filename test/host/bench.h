@@ -0,0 +1,93 @@
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Arduino.h"
+
+/*wall and process CPU time of one benchmark step, the emulator runs on the caller's thread*/
+struct bench_clock
+{
+	uint32_t wall_start;
+	double cpu_start;
+
+	static double cpu_ms()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+	}
+	bench_clock() : wall_start(millis()), cpu_start(cpu_ms()) {}
+	uint32_t wall() const { return millis() - wall_start; }
+	double cpu() const { return cpu_ms() - cpu_start; }
+};
+
+static inline void bench_header()
+{
+	printf("%-28s %9s %8s %10s %7s %9s\n", "step", "bytes", "wall ms", "bytes/s", "trips", "cpu ms");
+}
+
+static inline void bench_line(const char *step, uint32_t bytes, const bench_clock &clock, uint32_t trips)
+{
+	uint32_t wall = clock.wall();
+	printf("%-28s %9u %8u %10.0f %7u %9.1f\n", step, bytes, wall, wall ? bytes * 1000.0 / wall : 0.0, trips, clock.cpu());
+}
+
+static inline bool bench_quick(int argc, char **argv)
+{
+	for(int i = 1; i < argc; i++) if(!strcmp(argv[i], "--quick")) return true;
+	return false;
+}
+
+/*a Stream sink that counts, optionally taking ms per write like a slow card or full after limit bytes*/
+class bench_sink : public Stream
+{
+public:
+	uint32_t count = 0;
+	uint32_t write_ms = 0;
+	uint32_t limit = 0;
+	std::string data;
+	bool keep = false;
+
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+	size_t write(uint8_t c) { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size)
+	{
+		if(write_ms) delay(write_ms);
+		if(limit && count + size > limit) size = limit > count ? limit - count : 0;
+		if(keep) data.append((const char *) buffer, size);
+		count += size;
+		return size;
+	}
+};
+
+/*a Stream source over a string, for stream posts*/
+class bench_source : public Stream
+{
+public:
+	std::string data;
+	size_t pos = 0;
+
+	bench_source(const std::string &d) : data(d) {}
+	int available() { return data.size() - pos; }
+	int read() { return pos < data.size() ? (uint8_t) data[pos++] : -1; }
+	int peek() { return pos < data.size() ? (uint8_t) data[pos] : -1; }
+	size_t write(uint8_t c) { return 0; }
+};
+
+/*deterministic test payload*/
+static inline std::string bench_payload(size_t size, uint32_t seed = 1)
+{
+	std::string s(size, 0);
+	for(size_t i = 0; i < size; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		s[i] = (char) (seed >> 16);
+	}
+	return s;
+}
+
+#endif //HOST_BENCH_H
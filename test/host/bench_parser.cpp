@@ -0,0 +1,206 @@
+#include <malloc.h>
+#include <new>
+#include <string>
+#include "sim800.h"
+#include "host_uart.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* Response parser micro-benchmark, the host twin of
+* examples/sim800_parser_benchmark.cpp: a recorded transcript goes
+* through readline(), is_urc(), expect() and expect_scan(). Every line
+* is in the RX buffer before the clock starts, so this is parser cost
+* plus the in-memory UART, no wire time. Reports ns/line, ns/byte and
+* heap allocations per operation.
+*/
+
+#define ROUNDS 2000
+
+static std::atomic<uint32_t> allocations(0);
+
+extern "C" void *__libc_malloc(size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *operator new(size_t size)
+{
+	void *p = malloc(size);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// replies and URCs as captured from a SIM800H during bring-up and HTTP
+static const char *const transcript[] = {
+	"OK",
+	"RDY",
+	"+CPIN: READY",
+	"Call Ready",
+	"SMS Ready",
+	"+CSMINS: 0,1",
+	"+CSQ: 18,0",
+	"+CREG: 0,1",
+	"+CGATT: 1",
+	"+COPS: 0,2,\"25001\"",
+	"+SAPBR: 1,1,\"10.173.12.201\"",
+	"+HTTPACTION: 0,200,18342",
+	"+HTTPREAD: 64",
+	"+CIPRXGET: 1,0",
+	"+CIPRXGET: 2,0,128,0",
+	"*PSUTTZ: 2017,4,20,12,5,30,\"+8\",0",
+	"+CCLK: \"17/04/20,12:05:31+08\"",
+	"+CBC: 0,87,4125",
+	"DATA ACCEPT: 0,512",
+};
+
+#define LINES (sizeof(transcript) / sizeof(transcript[0]))
+
+// expose the protected parser entry points
+class bench_sim800 : public sim800
+{
+public:
+	using sim800::is_urc;
+};
+
+struct bench_device : public host_device
+{
+	void receive(uint8_t c) {}
+};
+
+static bench_sim800 *modem;
+static host_uart *uart;
+
+static uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// queue one line and wait until all of it is in the RX buffer
+static void feed(const char *line)
+{
+	std::string s = std::string(line) + "\r\n";
+	uart->send((const uint8_t *) s.data(), s.size());
+	while((size_t) uart->available() < s.size()) taskYIELD();
+}
+
+static void report(const char *name, uint64_t ns, size_t lines, size_t bytes, uint32_t allocs)
+{
+	printf("%-12s %8.0f ns/line %7.1f ns/byte %6.2f allocs/op\n", name, (double) ns / lines, (double) ns / bytes, (double) allocs / lines);
+}
+
+static void bench_readline(int rounds)
+{
+	char buf[SIM800_BUFSIZE];
+	uint64_t ns = 0;
+	size_t bytes = 0, lines = 0;
+	uint32_t allocs = 0;
+	for(int r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < LINES; i++)
+		{
+			feed(transcript[i]);
+			uint32_t a = allocations;
+			uint64_t start = now_ns();
+			size_t len = modem->readline(buf, SIM800_BUFSIZE - 1, SIM800_SERIAL_TIMEOUT);
+			ns += now_ns() - start;
+			allocs += allocations - a;
+			CHECK_EQ(len, strlen(transcript[i]));
+			bytes += len + 2;
+			lines++;
+		}
+	}
+	report("readline", ns, lines, bytes, allocs);
+}
+
+static void bench_is_urc(int rounds)
+{
+	uint64_t ns = 0;
+	size_t bytes = 0, lines = 0;
+	uint32_t allocs = 0;
+	for(int r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < LINES; i++)
+		{
+			size_t len = strlen(transcript[i]);
+			uint32_t a = allocations;
+			uint64_t start = now_ns();
+			modem->is_urc(transcript[i], len);
+			ns += now_ns() - start;
+			allocs += allocations - a;
+			bytes += len;
+			lines++;
+		}
+	}
+	report("is_urc", ns, lines, bytes, allocs);
+}
+
+static void bench_expect(int rounds)
+{
+	uint64_t ns = 0;
+	size_t lines = 0;
+	uint32_t allocs = 0;
+	for(int r = 0; r < rounds; r++)
+	{
+		feed("Call Ready");// one URC to skip before the answer
+		feed("OK");
+		uint32_t a = allocations;
+		uint64_t start = now_ns();
+		CHECK(modem->expect_OK());
+		ns += now_ns() - start;
+		allocs += allocations - a;
+		lines += 2;
+	}
+	report("expect", ns, lines, lines * 8, allocs);
+}
+
+static void bench_expect_scan(int rounds)
+{
+	uint64_t ns = 0;
+	size_t lines = 0;
+	uint32_t allocs = 0;
+	for(int r = 0; r < rounds; r++)
+	{
+		unsigned short int status = 0;
+		unsigned long int length = 0;
+		feed("+HTTPACTION: 0,200,18342");
+		uint32_t a = allocations;
+		uint64_t start = now_ns();
+		CHECK(modem->expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length));
+		ns += now_ns() - start;
+		allocs += allocations - a;
+		CHECK_EQ(length, 18342);
+		lines++;
+	}
+	report("expect_scan", ns, lines, lines * 26, allocs);
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = bench_quick(argc, argv) ? ROUNDS / 20 : ROUNDS;
+	uart = &host_uart::get(SIM800_UART);
+	uart->reset();
+	bench_device device;
+	uart->attach(&device);
+	uart->pace(false);
+	modem = new bench_sim800;
+	modem->begin();
+	bench_readline(rounds);
+	bench_is_urc(rounds);
+	bench_expect(rounds);
+	bench_expect_scan(rounds);
+	return 0;
+}
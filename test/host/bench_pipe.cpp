@@ -0,0 +1,94 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_pipe.h"
+#include "sim800_emulator.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* HTTP_get into a slow sink, directly and through a sim800_pipe. The sink
+* takes write_ms per chunk, set so writing costs about as long as the link;
+* written directly the two add up, through the pipe the wall time should
+* come close to the slower of the two. A sink that fills up during the last
+* write fails the download with 1012. --quick uses a small payload.
+*/
+int main(int argc, char **argv)
+{
+	bool quick = bench_quick(argc, argv);
+	size_t size = quick ? 16 * 1024 : 128 * 1024;
+	std::string body = bench_payload(size);
+
+	sim800_emulator emu(SIM800_UART);
+	emu.serve("http://host/file", body);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+
+	printf("payload %u bytes at %u baud, chunks of %u\n", (unsigned) size, (unsigned) SIM800_BAUD, (unsigned) GSM_MAX_BUFFSIZE);
+	bench_header();
+	unsigned long int length = 0;
+	uint32_t trips, link_ms, chunks;
+
+	{
+		bench_sink sink;
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+		link_ms = clock.wall();
+		chunks = modem.at_commands - trips;
+		bench_line("link only", sink.count, clock, chunks);
+		CHECK_EQ(sink.count, size);
+	}
+	uint32_t write_ms = link_ms / ((size + GSM_MAX_BUFFSIZE - 1) / GSM_MAX_BUFFSIZE);
+	if(!write_ms) write_ms = 1;
+	uint32_t sink_ms = write_ms * ((size + GSM_MAX_BUFFSIZE - 1) / GSM_MAX_BUFFSIZE);
+	uint32_t direct_ms;
+	{
+		bench_sink sink;
+		sink.write_ms = write_ms;
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+		direct_ms = clock.wall();
+		bench_line("direct, slow sink", sink.count, clock, modem.at_commands - trips);
+		CHECK_EQ(sink.count, size);
+	}
+	uint32_t piped_ms;
+	{
+		bench_sink sink;
+		sink.write_ms = write_ms;
+		sink.keep = true;
+		sim800_pipe pipe(sink);
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, pipe), 200);
+		piped_ms = clock.wall();
+		bench_line("pipe, slow sink", sink.count, clock, modem.at_commands - trips);
+		CHECK(sink.data == body);
+		sim800_pipe_stats stats;
+		pipe.report(stats);
+		printf("pipe: %u chunks, max fill %u, read stall %u ms, write stall %u ms\n", stats.chunks, stats.max_fill, stats.read_stall_ms, stats.write_stall_ms);
+	}
+	uint32_t bound = max(link_ms, sink_ms);
+	printf("link %u ms, sink %u ms (%u ms per write): direct %u ms, pipe %u ms, max %u ms\n", link_ms, sink_ms, write_ms, direct_ms, piped_ms, bound);
+	CHECK(direct_ms >= link_ms + sink_ms * 9 / 10);
+	CHECK(piped_ms < direct_ms);
+	//one chunk of each side cannot overlap, plus scheduling slack
+	CHECK(piped_ms <= bound * 5 / 4 + 2 * write_ms + 50);
+
+	// only the writer task sees the last write come up short
+	{
+		bench_sink sink;
+		sink.limit = size - 10;
+		sim800_pipe pipe(sink);
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, pipe), 1012);
+		CHECK(pipe.failed());
+		CHECK_EQ(sink.count, size - 10);
+	}
+	{
+		bench_sink sink;
+		sink.limit = size - 10;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 1012);
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include "sim800.h"
+#include "sim800_pool.h"
+#include "sim800_emulator.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* Pool scaling: several client threads post through a pool of one, two
+* and three emulated modems. With the modems working in parallel the
+* wall time should drop close to 1 / modems. --quick posts less.
+*/
+int main(int argc, char **argv)
+{
+	bool quick = bench_quick(argc, argv);
+	uint32_t clients = 6, posts = quick ? 2 : 8;
+	std::string body = bench_payload(quick ? 1024 : 4096);
+
+	sim800_emulator *emu[SIM800_POOL_MAX];
+	sim800 *modem[SIM800_POOL_MAX];
+	for(uint8_t i = 0; i < SIM800_POOL_MAX; i++)
+	{
+		sim800_board board = SIM800_BOARD_DEFAULT;
+		board.uart = i + 1;
+		emu[i] = new sim800_emulator(i + 1);
+		modem[i] = new sim800(board);
+		modem[i]->begin();
+		CHECK(modem[i]->expect_AT_OK(F("")));
+	}
+
+	printf("%u clients, %u posts of %u bytes each\n", clients, posts, (unsigned) body.size());
+	bench_header();
+	uint32_t single = 0;
+	for(uint8_t n = 1; n <= SIM800_POOL_MAX; n++)
+	{
+		sim800_pool pool;
+		for(uint8_t i = 0; i < n; i++) CHECK(pool.add(*modem[i]));
+		uint32_t trips = 0, before = 0, sent = 0;
+		for(uint8_t i = 0; i < n; i++) before += modem[i]->at_commands;
+		bench_clock clock;
+		std::vector<std::thread> threads;
+		for(uint32_t c = 0; c < clients; c++) threads.push_back(std::thread([&]
+		{
+			for(uint32_t k = 0; k < posts; k++)
+			{
+				unsigned long int length = 0;
+				CHECK_EQ(pool.HTTP_post("http://host/post", &length, (char *) body.data(), body.size()), 200);
+			}
+		}));
+		for(std::thread &t : threads) t.join();
+		for(uint8_t i = 0; i < n; i++) trips += modem[i]->at_commands;
+		for(uint8_t i = 0; i < n; i++)
+		{
+			sim800_pool_stats stats;
+			pool.report(i, stats);
+			sent += stats.bytes;
+		}
+		char step[32];
+		snprintf(step, sizeof(step), "pool of %u", n);
+		bench_line(step, sent, clock, trips - before);
+		CHECK_EQ(sent, clients * posts * body.size());
+		CHECK_EQ(pool.failovers, 0);
+		if(n == 1) single = clock.wall();
+		else CHECK(clock.wall() < single);
+	}
+	for(uint8_t i = 0; i < SIM800_POOL_MAX; i++)
+	{
+		delete modem[i];
+		delete emu[i];
+	}
+	return 0;
+}
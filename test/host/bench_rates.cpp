@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "host_esp.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* HTTP_get and OTA throughput per UART rate. The emulated modem garbles
+* bytes above reliable_baud, so the top rate either fails its AT+IPR
+* probes or steps down after SIM800_BAUD_ERRORS garbled lines; the rows
+* show the rate asked for, the one the session ended on and whether the
+* bodies survived. They must arrive intact at every reliable rate.
+*/
+static const uint32_t rates[] = {57600, 115200, 230400, 460800};
+
+int main(int argc, char **argv)
+{
+	bool quick = bench_quick(argc, argv);
+	size_t size = quick ? 4 * 1024 : 32 * 1024;
+	std::string body = bench_payload(size);
+	uint32_t reliable = 230400;
+	srand(1);
+
+	printf("payload %u bytes, reliable up to %u baud\n", (unsigned) size, reliable);
+	bench_header();
+	for(uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+	{
+		sim800_emulator emu(SIM800_UART);
+		emu.reliable_baud = reliable;
+		emu.noise = 2;// light enough to pass the probes now and then
+		emu.serve("http://host/file", body);
+		sim800 modem;
+		modem.begin();
+		CHECK(modem.expect_AT_OK(F("")));
+		bool switched = modem.set_baud(rates[i]);
+		char step[32];
+		unsigned long int length = 0;
+
+		bench_sink sink;
+		sink.keep = true;
+		uint32_t trips = modem.at_commands;
+		uint32_t garbled = emu.uart().stats().garbled;
+		bench_clock clock;
+		unsigned short int status = modem.HTTP_get("http://host/file", &length, sink);
+		snprintf(step, sizeof(step), "HTTP_get @%u", rates[i]);
+		bench_line(step, sink.count, clock, modem.at_commands - trips);
+		bool intact = status == 200 && sink.data == body;
+
+		trips = modem.at_commands;
+		clock = bench_clock();
+		bool ota = modem.HTTP_get("http://host/file", &length) == 200;
+		size_t n = 0;
+		if(ota)
+		{
+			esp_ota_handle_t handle;
+			CHECK_EQ(esp_ota_begin(esp_ota_get_next_update_partition(NULL), OTA_SIZE_UNKNOWN, &handle), ESP_OK);
+			n = modem.HTTP_read_ota(handle, 0, length);
+			ota = esp_ota_end(handle) == ESP_OK && host_ota_image() == body;
+		}
+		snprintf(step, sizeof(step), "OTA @%u", rates[i]);
+		bench_line(step, n, clock, modem.at_commands - trips);
+		modem.expect_AT_OK(F(""));// a step down happens on the next command
+
+		printf("  switched %s, ended on %u baud, %u bytes garbled, HTTP %s, OTA %s\n", switched ? "yes" : "no",
+			emu.uart().baud(), emu.uart().stats().garbled - garbled, intact ? "intact" : "damaged", ota ? "intact" : "damaged");
+		if(rates[i] <= reliable)
+		{
+			CHECK(switched);
+			CHECK(intact);
+			CHECK(ota);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "host_esp.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* Throughput of the transfer paths against the emulator at 115200 baud:
+* HTTP_get into a stream, HTTP_post from a buffer and a stream, a socket
+* send/receive echo and an OTA download. Reports bytes/s, AT round trips
+* and CPU time; --quick uses small payloads for ctest.
+*/
+int main(int argc, char **argv)
+{
+	bool quick = bench_quick(argc, argv);
+	size_t size = quick ? 8 * 1024 : 64 * 1024;
+	std::string body = bench_payload(size);
+
+	sim800_emulator emu(SIM800_UART);
+	emu.serve("http://host/file", body);
+	emu.serve("http://host/ota", body);
+	emu.on_tcp = [](sim800_emulator &e, const std::string &data) { e.tcp_push(data); };
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+
+	printf("payload %u bytes at %u baud\n", (unsigned) size, (unsigned) SIM800_BAUD);
+	bench_header();
+	uint32_t trips;
+	unsigned long int length = 0;
+
+	{
+		bench_sink sink;
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+		bench_line("HTTP_get stream", sink.count, clock, modem.at_commands - trips);
+		CHECK_EQ(sink.count, size);
+	}
+	{
+		std::string post = body.substr(0, quick ? 2048 : 16 * 1024);
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_post("http://host/post", &length, (char *) post.data(), post.size()), 200);
+		bench_line("HTTP_post buffer", post.size(), clock, modem.at_commands - trips);
+		CHECK(emu.posts.back().second == post);
+	}
+	{
+		bench_source source(body);
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_post("http://host/post", length, source, body.size()), 200);
+		bench_line("HTTP_post stream", body.size(), clock, modem.at_commands - trips);
+		CHECK(emu.posts.back().second == body);
+	}
+	{
+		CHECK(modem.connect("host", 7));
+		std::string echo;
+		char buf[1024];
+		trips = modem.at_commands;
+		bench_clock clock;
+		for(size_t pos = 0; pos < size; pos += sizeof(buf))
+		{
+			unsigned long int accepted = 0;
+			size_t n = min(sizeof(buf), size - pos);
+			memcpy(buf, body.data() + pos, n);
+			CHECK(modem.send(buf, n, accepted));
+			size_t got = 0;
+			while(got < n) got += modem.receive(buf + got, n - got);
+			echo.append(buf, got);
+		}
+		bench_line("send/receive echo", echo.size() * 2, clock, modem.at_commands - trips);
+		CHECK(echo == body);
+		modem.disconnect();
+	}
+	{
+		trips = modem.at_commands;
+		bench_clock clock;
+		CHECK_EQ(modem.HTTP_get("http://host/ota", &length), 200);
+		esp_ota_handle_t handle;
+		CHECK_EQ(esp_ota_begin(esp_ota_get_next_update_partition(NULL), OTA_SIZE_UNKNOWN, &handle), ESP_OK);
+		size_t n = modem.HTTP_read_ota(handle, 0, length);
+		CHECK_EQ(esp_ota_end(handle), ESP_OK);
+		bench_line("OTA HTTP_read_ota", n, clock, modem.at_commands - trips);
+		CHECK(host_ota_image() == body);
+	}
+	host_uart_stats stats = emu.uart().stats();
+	printf("uart: %u bytes out, %u in, %u overruns\n", stats.tx_bytes, stats.rx_bytes, stats.overruns);
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef HOST_CHECK_H
+#define HOST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*minimal assertions for the host tests, a failure ends the test*/
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); exit(1); } } while(0)
+#define CHECK_EQ(a, b) do { long long _a = (long long) (a), _b = (long long) (b); if(_a != _b) { fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); exit(1); } } while(0)
+#define CHECK_STR(a, b) do { if(strcmp((a), (b))) { fprintf(stderr, "%s:%d: \"%s\" != \"%s\"\n", __FILE__, __LINE__, (a), (b)); exit(1); } } while(0)
+
+#endif //HOST_CHECK_H
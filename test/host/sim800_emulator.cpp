@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim800_emulator.h"
+
+#define DATA_HTTP 1
+#define DATA_TCP  2
+
+static bool starts(const std::string &s, const char *prefix)
+{
+	return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+sim800_emulator::sim800_emulator(int uart) : _uart(host_uart::get(uart))
+{
+	_uart.reset();
+	_uart.attach(this);
+}
+
+sim800_emulator::~sim800_emulator()
+{
+	_uart.attach(nullptr);
+}
+
+void sim800_emulator::pace(bool on)
+{
+	_uart.pace(on);
+}
+
+host_uart &sim800_emulator::uart()
+{
+	return _uart;
+}
+
+void sim800_emulator::serve(const std::string &url, const std::string &body, int status)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_files[url] = {status, body};
+}
+
+void sim800_emulator::latency_for(const std::string &prefix, uint32_t ms)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_latency[prefix] = ms;
+}
+
+void sim800_emulator::script(const std::string &prefix, const std::string &reply, uint32_t delay)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_script.push_back({prefix, reply, delay});
+}
+
+void sim800_emulator::urc(const std::string &line, uint32_t delay)
+{
+	answer(line, delay);
+}
+
+void sim800_emulator::tcp_push(const std::string &data)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	bool was_empty = _tcp_in.empty();
+	_tcp_in += data;
+	if(was_empty) answer("+CIPRXGET: 1,0", latency);
+}
+
+void sim800_emulator::stall_input(uint32_t after_bytes, uint32_t ms, uint32_t buffer)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_stall_after = after_bytes;
+	_stall_ms = ms;
+	_stall_buffer = buffer;
+}
+
+void sim800_emulator::boot()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_ready_at = host_micros() + (uint64_t) boot_ms * 1000;
+	_http = false;
+	tcp_open = false;
+	bearer = false;
+	answer("RDY", boot_ms);
+	answer("+CFUN: 1", boot_ms + 50);
+	if(sim) answer("+CPIN: READY", boot_ms + 100);
+	answer("Call Ready", call_ready_ms);
+	answer("SMS Ready", call_ready_ms + 100);
+	_sms_ready_at = host_micros() + (uint64_t) (call_ready_ms + 100) * 1000;
+}
+
+bool sim800_emulator::http_open()
+{
+	return _http;
+}
+
+uint32_t sim800_emulator::count(const std::string &prefix)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	uint32_t n = 0;
+	for(size_t i = 0; i < _commands.size(); i++) if(starts(_commands[i], prefix.c_str())) n++;
+	return n;
+}
+
+std::vector<std::string> sim800_emulator::commands()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	return _commands;
+}
+
+bool sim800_emulator::ready()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	return !(host_micros() < _stall_until && _stalled_bytes >= _stall_buffer);
+}
+
+// runs on the writer's thread, one byte at a time
+void sim800_emulator::receive(uint8_t c)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	bool lf = _after_cr && c == '\n';// the LF ending a command line is not data
+	_after_cr = false;
+	if(lf) return;
+	if(_data_mode)
+	{
+		_data += (char) c;
+		_data_count++;
+		if(host_micros() < _stall_until) _stalled_bytes++;
+		else if(_stall_after && _data_count == _stall_after)
+		{
+			_stall_until = host_micros() + (uint64_t) _stall_ms * 1000;
+			_stalled_bytes = 0;
+			_stall_after = 0;
+		}
+		if(!--_data_left) data_done();
+		return;
+	}
+	if(c & 0x80)// sent at another rate
+	{
+		_line.clear();
+		return;
+	}
+	if(c != '\r')
+	{
+		_line += (char) c;
+		return;
+	}
+	_after_cr = true;
+	std::string line;
+	line.swap(_line);
+	if(line.empty()) return;
+	_commands.push_back(line);
+	if(host_micros() < _ready_at) return;// still booting
+	for(std::deque<rule>::iterator r = _script.begin(); r != _script.end(); r++)
+	{
+		if(!starts(line, r->prefix.c_str())) continue;
+		if(!r->reply.empty()) answer(r->reply, r->delay);
+		_script.erase(r);
+		return;
+	}
+	command(line);
+}
+
+uint32_t sim800_emulator::delay_for(const std::string &line)
+{
+	uint32_t ms = latency;
+	size_t best = 0;
+	for(std::map<std::string, uint32_t>::iterator i = _latency.begin(); i != _latency.end(); i++)
+	{
+		if(i->first.size() >= best && starts(line, i->first.c_str()))
+		{
+			best = i->first.size();
+			ms = i->second;
+		}
+	}
+	return ms;
+}
+
+// each line framed as <CR><LF>line<CR><LF>, lines separated by \n
+void sim800_emulator::answer(const std::string &lines, uint32_t delay)
+{
+	std::string out;
+	size_t from = 0;
+	while(from <= lines.size())
+	{
+		size_t to = lines.find('\n', from);
+		if(to == std::string::npos) to = lines.size();
+		out += "\r\n" + lines.substr(from, to - from) + "\r\n";
+		from = to + 1;
+	}
+	raw(out, delay);
+}
+
+void sim800_emulator::raw(const std::string &bytes, uint32_t delay)
+{
+	_uart.send((const uint8_t *) bytes.data(), bytes.size(), delay);
+}
+
+std::string sim800_emulator::quoted(const std::string &line, size_t from)
+{
+	size_t a = line.find('"', from);
+	if(a == std::string::npos) return "";
+	size_t b = line.find('"', a + 1);
+	if(b == std::string::npos) return "";
+	return line.substr(a + 1, b - a - 1);
+}
+
+void sim800_emulator::data_done()
+{
+	uint32_t d = latency;
+	if(_data_mode == DATA_HTTP)
+	{
+		answer("OK", d);
+	}
+	else
+	{
+		tcp_sent += _data;
+		answer("DATA ACCEPT: 0," + std::to_string(_data.size()), d);
+		if(on_tcp) on_tcp(*this, _data);
+	}
+	_data_mode = 0;
+}
+
+void sim800_emulator::command(const std::string &line)
+{
+	uint32_t d = delay_for(line);
+	uint64_t now = host_micros();
+	char buf[160];
+	if(line == "AT" || line == "ATZ" || line == "ATE0" || line == "ATE1")
+	{
+		answer("OK", d);
+	}
+	else if(line == "AT+CFUN=1,1")
+	{
+		answer("OK", d);
+		boot();
+	}
+	else if((starts(line, "AT+CNMI=") || starts(line, "AT+GSMBUSY=")) && now < _sms_ready_at)
+	{
+		not_ready++;
+		answer("ERROR", d);
+	}
+	else if(starts(line, "AT+CFUN=") || starts(line, "AT+CSCLK=") || starts(line, "AT+CNMI=") || starts(line, "AT+GSMBUSY=")
+		|| starts(line, "AT+CFGRI=") || starts(line, "AT+CLTS=") || starts(line, "AT+COPS=3") || starts(line, "AT+CMEE=")
+		|| starts(line, "AT+CIPMUX=") || starts(line, "AT+CIPRXGET=1") || starts(line, "AT+CIPQSEND=") || starts(line, "AT+CSTT=")
+		|| starts(line, "AT+CIICR") || starts(line, "AT+SAPBR=3,") || starts(line, "AT+SAPBR=5,") || starts(line, "AT+CPIN="))
+	{
+		answer("OK", d);
+	}
+	else if(starts(line, "AT+IPR="))
+	{
+		uint32_t rate = strtoul(line.c_str() + 7, NULL, 10);
+		answer("OK", d);
+		_uart.device_baud(rate);
+		_uart.noise(rate > reliable_baud ? noise : 0);
+	}
+	else if(starts(line, "AT+IFC="))
+	{
+		answer("OK", d);
+	}
+	else if(line == "AT+CBC") answer("+CBC: 0,80,4100\nOK", d);
+	else if(line == "AT+CADC?") answer("+CADC: 1,500\nOK", d);
+	else if(line == "AT+CPIN?") answer(sim ? "+CPIN: READY\nOK" : "+CME ERROR: 10", d);
+	else if(line == "AT+CSMINS?") answer(sim ? "+CSMINS: 0,1\nOK" : "+CSMINS: 0,0\nOK", d);
+	else if(line == "AT+CIMI") answer(imsi + "\nOK", d);
+	else if(line == "AT+GSN") answer(imei + "\nOK", d);
+	else if(line == "AT+CSQ")
+	{
+		snprintf(buf, sizeof(buf), "+CSQ: %d,0\nOK", rssi);
+		answer(buf, d);
+	}
+	else if(line == "AT+CREG?")
+	{
+		bool ok = registered && now >= _ready_at + (uint64_t) register_ms * 1000;
+		answer(ok ? "+CREG: 0,1\nOK" : "+CREG: 0,2\nOK", d);
+	}
+	else if(line == "AT+CGATT?") answer(attached ? "+CGATT: 1\nOK" : "+CGATT: 0\nOK", d);
+	else if(starts(line, "AT+CGATT="))
+	{
+		attached = line[9] == '1' && registered;
+		answer(attached || line[9] == '0' ? "OK" : "ERROR", d);
+	}
+	else if(line == "AT+COPS?") answer("+COPS: 0,2,\"" + op + "\"\nOK", d);
+	else if(line == "AT+SAPBR=1,1")
+	{
+		bearer = attached;
+		answer(bearer ? "OK" : "ERROR", d);
+	}
+	else if(line == "AT+SAPBR=0,1")
+	{
+		bearer = false;
+		answer("OK", d);
+	}
+	else if(line == "AT+SAPBR=2,1") answer(bearer ? "+SAPBR: 1,1,\"10.1.2.3\"\nOK" : "+SAPBR: 1,3,\"0.0.0.0\"\nOK", d);
+	else if(line == "AT+CCLK?") answer("+CCLK: \"24/05/01,12:00:00+08\"\nOK", d);
+	else if(line == "AT+CIPGSMLOC=1,1") answer("+CIPGSMLOC: 0,13.404954,52.520008,2024/05/01,12:00:00\nOK", d);
+	else if(line == "AT+HTTPINIT")
+	{
+		answer(_http ? "ERROR" : "OK", d);
+		_http = true;
+	}
+	else if(line == "AT+HTTPTERM")
+	{
+		answer(_http ? "OK" : "ERROR", d);
+		_http = false;
+	}
+	else if(starts(line, "AT+HTTPPARA="))
+	{
+		if(starts(line, "AT+HTTPPARA=\"URL\"")) _url = quoted(line, 17);
+		answer(_http ? "OK" : "ERROR", d);
+	}
+	else if(starts(line, "AT+HTTPDATA="))
+	{
+		_data_left = strtoul(line.c_str() + 12, NULL, 10);
+		if(!_http || !_data_left)
+		{
+			answer("ERROR", d);
+			return;
+		}
+		_data.clear();
+		_data_count = 0;
+		_data_mode = DATA_HTTP;
+		answer("DOWNLOAD", d);
+	}
+	else if(starts(line, "AT+HTTPACTION="))
+	{
+		int method = atoi(line.c_str() + 14);
+		if(!_http || method > 1)
+		{
+			answer("ERROR", d);
+			return;
+		}
+		_response.clear();
+		if(method == 0)
+		{
+			std::map<std::string, file>::iterator f = _files.find(_url);
+			_status = f == _files.end() ? 404 : f->second.status;
+			if(f != _files.end()) _response = f->second.body;
+		}
+		else
+		{
+			posts.push_back(std::make_pair(_url, _data));
+			_status = on_post ? on_post(_url, _data, _response) : post_status;
+			if(!on_post) _response = post_response;
+		}
+		answer("OK", d);
+		snprintf(buf, sizeof(buf), "+HTTPACTION: %d,%d,%u", method, _status, (unsigned) _response.size());
+		answer(buf, d + action_latency);
+	}
+	else if(starts(line, "AT+HTTPREAD"))
+	{
+		size_t start = 0, len = _response.size();
+		if(line.size() > 12 && line[11] == '=') sscanf(line.c_str() + 12, "%zu,%zu", &start, &len);
+		if(!_http || start > _response.size())
+		{
+			answer("ERROR", d);
+			return;
+		}
+		std::string part = _response.substr(start, len);
+		raw("\r\n+HTTPREAD: " + std::to_string(part.size()) + "\r\n" + part + "\r\nOK\r\n", d);
+	}
+	else if(line == "AT+CIPSHUT")
+	{
+		tcp_open = false;
+		_tcp_in.clear();
+		answer("SHUT OK", d);
+	}
+	else if(line == "AT+CIFSR") answer(bearer || attached ? "10.1.2.3" : "ERROR", d);
+	else if(starts(line, "AT+CIPSTART="))
+	{
+		answer("OK", d);
+		tcp_open = attached;
+		answer(tcp_open ? "0, CONNECT OK" : "0, CONNECT FAIL", d + connect_latency);
+	}
+	else if(starts(line, "AT+CIPSEND=0,"))
+	{
+		_data_left = strtoul(line.c_str() + 13, NULL, 10);
+		if(!tcp_open || !_data_left)
+		{
+			answer("ERROR", d);
+			return;
+		}
+		_data.clear();
+		_data_count = 0;
+		_data_mode = DATA_TCP;
+		raw("\r\n> ", d);
+	}
+	else if(starts(line, "AT+CIPRXGET=2,0,"))
+	{
+		size_t n = strtoul(line.c_str() + 16, NULL, 10);
+		if(n > _tcp_in.size()) n = _tcp_in.size();
+		std::string part = _tcp_in.substr(0, n);
+		_tcp_in.erase(0, n);
+		raw("\r\n+CIPRXGET: 2,0," + std::to_string(n) + "," + std::to_string(_tcp_in.size()) + "\r\n" + part + "\r\nOK\r\n", d);
+	}
+	else if(line == "AT+CIPCLOSE=0")
+	{
+		tcp_open = false;
+		answer("0, CLOSE OK", d);
+	}
+	else if(line == "AT+CIPSTATUS=0")
+	{
+		answer(tcp_open ? "+CIPSTATUS: 0,0,\"TCP\",\"10.0.0.1\",\"1883\",\"CONNECTED\"\nOK" : "+CIPSTATUS: 0,,\"\",\"\",\"\",\"INITIAL\"\nOK", d);
+	}
+	else answer("ERROR", d);
+}
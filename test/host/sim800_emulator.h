@@ -0,0 +1,129 @@
+#ifndef SIM800_EMULATOR_H
+#define SIM800_EMULATOR_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "host_uart.h"
+
+/**
+* A SIM800 on the other end of a host_uart. It answers the AT commands
+* the library sends with replies paced at the line rate after a command
+* latency, and models what the tests need: boot URCs, registration, the
+* bearer, AT+IPR with garbling at the wrong or an unreliable rate, the
+* HTTP stack with served files and recorded posts, one TCP socket with a
+* server callback, and a modem input that stalls during data mode.
+* AT+CNMI and AT+GSMBUSY are refused until SMS Ready after a boot.
+* script() overrides the reply to the next matching command, urc()
+* injects unsolicited lines.
+*/
+class sim800_emulator : public host_device
+{
+public:
+	// timing, in ms
+	uint32_t latency = 10;
+	uint32_t action_latency = 200;
+	uint32_t connect_latency = 100;
+	uint32_t boot_ms = 1500;
+	uint32_t call_ready_ms = 2500;
+	uint32_t register_ms = 500;
+
+	// network state
+	int rssi = 20;
+	bool registered = true;
+	bool attached = true;
+	bool bearer = true;
+	bool sim = true;
+	uint32_t reliable_baud = 460800;
+	uint16_t noise = 30;// per mille of the bytes garbled above reliable_baud
+	std::string imei = "861234567890123";
+	std::string imsi = "250011234567890";
+	std::string op = "25001";
+	uint32_t not_ready = 0;// AT+CNMI and AT+GSMBUSY refused before SMS Ready
+
+	// HTTP server
+	int post_status = 200;
+	std::string post_response;
+	std::function<int(const std::string &url, const std::string &body, std::string &response)> on_post;
+	std::vector<std::pair<std::string, std::string> > posts;
+
+	// TCP peer, bytes the library sent and a callback to answer them
+	std::string tcp_sent;
+	std::function<void(sim800_emulator &emu, const std::string &data)> on_tcp;
+	bool tcp_open = false;
+
+	sim800_emulator(int uart);
+	~sim800_emulator();
+
+	void pace(bool on);
+	void serve(const std::string &url, const std::string &body, int status = 200);
+	void latency_for(const std::string &prefix, uint32_t ms);
+	/*the next command starting with prefix gets reply instead, "" gets none*/
+	void script(const std::string &prefix, const std::string &reply, uint32_t delay = 0);
+	void urc(const std::string &line, uint32_t delay = 0);
+	/*queues socket data for AT+CIPRXGET and raises +CIPRXGET: 1,0*/
+	void tcp_push(const std::string &data);
+	/*after after_bytes of a data mode body the modem stops taking input for ms, once buffer bytes queued up*/
+	void stall_input(uint32_t after_bytes, uint32_t ms, uint32_t buffer);
+	/*power-on: boot URCs, registration register_ms after RDY*/
+	void boot();
+	bool http_open();
+	uint32_t count(const std::string &prefix);
+	std::vector<std::string> commands();
+	host_uart &uart();
+
+	void receive(uint8_t c);
+	bool ready();
+
+protected:
+	struct rule
+	{
+		std::string prefix;
+		std::string reply;
+		uint32_t delay;
+	};
+	struct file
+	{
+		int status;
+		std::string body;
+	};
+
+	host_uart &_uart;
+	std::recursive_mutex _mutex;
+	std::string _line;
+	bool _after_cr = false;
+	std::vector<std::string> _commands;
+	std::deque<rule> _script;
+	std::map<std::string, uint32_t> _latency;
+	std::map<std::string, file> _files;
+	uint64_t _ready_at = 0;
+	uint64_t _sms_ready_at = 0;
+	bool _http = false;
+	std::string _url;
+	std::string _response;
+	int _status = 0;
+	std::string _tcp_in;
+	// data mode: HTTPDATA, CIPSEND
+	int _data_mode = 0;
+	size_t _data_left = 0;
+	std::string _data;
+	uint32_t _data_count = 0;
+	uint32_t _stall_after = 0;
+	uint32_t _stall_ms = 0;
+	uint32_t _stall_buffer = 0;
+	uint64_t _stall_until = 0;
+	uint32_t _stalled_bytes = 0;
+
+	void command(const std::string &line);
+	void data_done();
+	uint32_t delay_for(const std::string &line);
+	void answer(const std::string &lines, uint32_t delay);
+	void raw(const std::string &bytes, uint32_t delay);
+	static std::string quoted(const std::string &line, size_t from);
+};
+
+#endif //SIM800_EMULATOR_H
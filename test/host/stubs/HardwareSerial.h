@@ -0,0 +1,36 @@
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Stream.h"
+
+#define SERIAL_8N1 0x800001c
+
+/**
+* HardwareSerial backed by the in-memory host_uart of the same number.
+* UART 0 without an attached device writes to stdout, like the console.
+*/
+class HardwareSerial : public Stream
+{
+public:
+	HardwareSerial(int uart_nr) : _uart_nr(uart_nr) {}
+	void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx = -1, int8_t tx = -1, bool invert = false, unsigned long timeout_ms = 20000UL);
+	void end();
+	void updateBaudRate(unsigned long baud);
+	uint32_t baudRate();
+	size_t setRxBufferSize(size_t size);
+	int available();
+	int read();
+	int peek();
+	void flush();
+	size_t write(uint8_t c) { return write(&c, 1); }
+	size_t write(const uint8_t *buffer, size_t size);
+	using Print::write;
+	operator bool() const { return true; }
+
+protected:
+	int _uart_nr;
+};
+
+extern HardwareSerial Serial;
+
+#endif //HOST_HARDWARESERIAL_H
@@ -0,0 +1,43 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class String;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/*the Arduino Print interface, text output goes through write()*/
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	size_t write(const char *s) { return s ? write((const uint8_t *) s, strlen(s)) : 0; }
+	size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+	virtual void flush() {}
+
+	size_t print(const char *s) { return write(s); }
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(const String &s);
+	size_t print(int n, int base = DEC) { return print((long) n, base); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(long long n, int base = DEC) { return print((long) n, base); }
+	size_t print(unsigned long long n, int base = DEC) { return print((unsigned long) n, base); }
+	size_t print(double n, int digits = 2);
+
+	size_t println() { return write("\r\n"); }
+	template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+	template <typename T> size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+#endif //HOST_PRINT_H
@@ -0,0 +1,22 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include "Print.h"
+
+/*the Arduino Stream interface*/
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	size_t readBytes(char *buffer, size_t length);
+	size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+
+protected:
+	unsigned long _timeout = 1000;
+	int timedRead();
+};
+
+#endif //HOST_STREAM_H
@@ -0,0 +1,21 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <string>
+
+/*the few String operations the library uses*/
+class String
+{
+public:
+	String(const char *s = "") : _s(s ? s : "") {}
+	String(const std::string &s) : _s(s) {}
+	const char *c_str() const { return _s.c_str(); }
+	unsigned int length() const { return _s.length(); }
+	String operator+(const String &o) const { return String(_s + o._s); }
+	bool operator==(const String &o) const { return _s == o._s; }
+
+private:
+	std::string _s;
+};
+
+#endif //HOST_WSTRING_H
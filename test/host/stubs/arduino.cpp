@@ -0,0 +1,246 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "Arduino.h"
+#include "host_esp.h"
+#include "host_uart.h"
+
+#define HOST_PINS 64
+
+struct host_pin
+{
+	uint8_t mode;
+	int level;
+	void (*handler)(void *);
+	void *arg;
+	int edge;
+};
+
+static host_pin pins[HOST_PINS];
+static std::mutex pin_mutex;
+
+HardwareSerial Serial(0);
+
+uint32_t millis()
+{
+	return host_micros() / 1000;
+}
+
+uint32_t micros()
+{
+	return host_micros();
+}
+
+void delay(uint32_t ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield()
+{
+	std::this_thread::yield();
+}
+
+long random(long max)
+{
+	return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+	return max > min ? min + rand() % (max - min) : min;
+}
+
+void randomSeed(unsigned long seed)
+{
+	srand(seed);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	std::lock_guard<std::mutex> guard(pin_mutex);
+	pins[pin % HOST_PINS].mode = mode;
+	if(mode == INPUT_PULLUP) pins[pin % HOST_PINS].level = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	std::lock_guard<std::mutex> guard(pin_mutex);
+	pins[pin % HOST_PINS].level = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+	std::lock_guard<std::mutex> guard(pin_mutex);
+	return pins[pin % HOST_PINS].level;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode)
+{
+	std::lock_guard<std::mutex> guard(pin_mutex);
+	pins[pin % HOST_PINS].handler = handler;
+	pins[pin % HOST_PINS].arg = arg;
+	pins[pin % HOST_PINS].edge = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+	std::lock_guard<std::mutex> guard(pin_mutex);
+	pins[pin % HOST_PINS].handler = nullptr;
+}
+
+void host_pin_set(uint8_t pin, int level)
+{
+	host_pin &p = pins[pin % HOST_PINS];
+	void (*handler)(void *) = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(pin_mutex);
+		int was = p.level;
+		p.level = level;
+		if(p.handler && was != level && (p.edge == CHANGE || (p.edge == FALLING && !level) || (p.edge == RISING && level))) handler = p.handler;
+	}
+	if(handler) handler(p.arg);
+}
+
+int host_pin_get(uint8_t pin)
+{
+	return digitalRead(pin);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while(size--) n += write(*buffer++);
+	return n;
+}
+
+size_t Print::print(const String &s)
+{
+	return write(s.c_str());
+}
+
+size_t Print::print(long n, int base)
+{
+	if(base == DEC) return printf("%ld", n);
+	return print((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+	char buf[8 * sizeof(long) + 1];
+	char *p = &buf[sizeof(buf) - 1];
+	*p = 0;
+	if(base < 2) base = DEC;
+	do
+	{
+		unsigned long d = n % base;
+		*--p = d < 10 ? '0' + d : 'A' + d - 10;
+		n /= base;
+	} while(n);
+	return write(p);
+}
+
+size_t Print::print(double n, int digits)
+{
+	return printf("%.*f", digits, n);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	char buf[256];
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if(n < 0) return 0;
+	return write((const uint8_t *) buf, (size_t) n < sizeof(buf) ? (size_t) n : sizeof(buf) - 1);
+}
+
+int Stream::timedRead()
+{
+	uint32_t start = millis();
+	do
+	{
+		int c = read();
+		if(c >= 0) return c;
+		yield();
+	} while(millis() - start < _timeout);
+	return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+	size_t n = 0;
+	while(n < length)
+	{
+		int c = timedRead();
+		if(c < 0) break;
+		buffer[n++] = c;
+	}
+	return n;
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rx, int8_t tx, bool invert, unsigned long timeout_ms)
+{
+	host_uart::get(_uart_nr).begin(baud);
+}
+
+void HardwareSerial::end()
+{
+	host_uart::get(_uart_nr).end();
+}
+
+void HardwareSerial::updateBaudRate(unsigned long baud)
+{
+	host_uart::get(_uart_nr).set_baud(baud);
+}
+
+uint32_t HardwareSerial::baudRate()
+{
+	return host_uart::get(_uart_nr).baud();
+}
+
+size_t HardwareSerial::setRxBufferSize(size_t size)
+{
+	return host_uart::get(_uart_nr).set_rx_buffer(size);
+}
+
+int HardwareSerial::available()
+{
+	return host_uart::get(_uart_nr).available();
+}
+
+int HardwareSerial::read()
+{
+	return host_uart::get(_uart_nr).read();
+}
+
+int HardwareSerial::peek()
+{
+	return host_uart::get(_uart_nr).peek();
+}
+
+void HardwareSerial::flush()
+{
+	if(!host_uart::get(_uart_nr).device()) fflush(stdout);
+}
+
+// the console is UART 0 with nothing attached
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	host_uart &uart = host_uart::get(_uart_nr);
+	if(!uart.device())
+	{
+		if(_uart_nr == 0) fwrite(buffer, 1, size, stdout);
+		return size;
+	}
+	return uart.write(buffer, size);
+}
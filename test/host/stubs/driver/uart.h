@@ -0,0 +1,23 @@
+#ifndef HOST_DRIVER_UART_H
+#define HOST_DRIVER_UART_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef int uart_port_t;
+
+typedef enum
+{
+	UART_HW_FLOWCTRL_DISABLE = 0x0,
+	UART_HW_FLOWCTRL_RTS = 0x1,
+	UART_HW_FLOWCTRL_CTS = 0x2,
+	UART_HW_FLOWCTRL_CTS_RTS = 0x3
+} uart_hw_flowcontrol_t;
+
+#define UART_PIN_NO_CHANGE (-1)
+
+esp_err_t uart_set_pin(uart_port_t uart, int tx, int rx, int rts, int cts);
+esp_err_t uart_set_hw_flow_ctrl(uart_port_t uart, uart_hw_flowcontrol_t flow, uint8_t rx_thresh);
+esp_err_t uart_set_loop_back(uart_port_t uart, bool loop_back);
+
+#endif //HOST_DRIVER_UART_H
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "nvs.h"
+#include "driver/uart.h"
+#include "host_esp.h"
+#include "host_uart.h"
+
+#define HOST_FLASH_SECTOR 4096
+
+struct host_partition
+{
+	esp_partition_t info;
+	std::vector<uint8_t> flash;
+};
+
+static std::mutex esp_mutex;
+static std::vector<std::unique_ptr<host_partition> > partitions;
+static std::map<std::string, std::map<std::string, std::vector<uint8_t> > > nvs;
+static std::vector<std::string> nvs_handles;
+static esp_partition_t ota_partition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x110000, 0x100000, "ota_1", false};
+static esp_partition_t app_partition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x100000, "ota_0", false};
+static std::string ota_image;
+
+static host_partition *find(const esp_partition_t *partition)
+{
+	for(size_t i = 0; i < partitions.size(); i++) if(&partitions[i]->info == partition) return partitions[i].get();
+	return nullptr;
+}
+
+const esp_partition_t *host_partition_add(const char *label, uint32_t size)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	host_partition *p = new host_partition;
+	p->info = {ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t) 0x99, 0x300000, size, "", false};
+	strncpy(p->info.label, label, sizeof(p->info.label) - 1);
+	p->flash.assign(size, 0xff);
+	partitions.emplace_back(p);
+	return &p->info;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	for(size_t i = partitions.size(); i--; )
+	{
+		esp_partition_t &info = partitions[i]->info;
+		if(info.type != type) continue;
+		if(subtype != ESP_PARTITION_SUBTYPE_ANY && info.subtype != subtype) continue;
+		if(label && strcmp(label, info.label)) continue;
+		return &info;
+	}
+	return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	host_partition *p = find(partition);
+	if(!p || offset + size > p->flash.size()) return ESP_ERR_INVALID_SIZE;
+	memcpy(dst, &p->flash[offset], size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	host_partition *p = find(partition);
+	if(!p || offset + size > p->flash.size()) return ESP_ERR_INVALID_SIZE;
+	const uint8_t *s = (const uint8_t *) src;
+	for(size_t i = 0; i < size; i++) p->flash[offset + i] &= s[i];
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	host_partition *p = find(partition);
+	if(!p || offset + size > p->flash.size()) return ESP_ERR_INVALID_SIZE;
+	if(offset % HOST_FLASH_SECTOR || size % HOST_FLASH_SECTOR) return ESP_ERR_INVALID_ARG;
+	memset(&p->flash[offset], 0xff, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	ota_image.clear();
+	*out_handle = 1;
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	if(handle != 1) return ESP_ERR_INVALID_ARG;
+	ota_image.append((const char *) data, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+	return handle == 1 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+	return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition()
+{
+	return &app_partition;
+}
+
+const esp_partition_t *esp_ota_get_running_partition()
+{
+	return &app_partition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+	return &ota_partition;
+}
+
+const std::string &host_ota_image()
+{
+	return ota_image;
+}
+
+void esp_restart()
+{
+	fprintf(stderr, "esp_restart()\n");
+	exit(0);
+}
+
+void host_nvs_clear()
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	nvs.clear();
+}
+
+// handles index nvs_handles, 0 is never handed out
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out_handle)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	if(mode == NVS_READONLY && !nvs.count(name)) return ESP_ERR_NVS_NOT_FOUND;
+	nvs[name];
+	nvs_handles.push_back(name);
+	*out_handle = nvs_handles.size();
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	if(!handle || handle > nvs_handles.size()) return ESP_ERR_INVALID_ARG;
+	std::map<std::string, std::vector<uint8_t> > &space = nvs[nvs_handles[handle - 1]];
+	if(!space.count(key)) return ESP_ERR_NVS_NOT_FOUND;
+	std::vector<uint8_t> &blob = space[key];
+	if(!out_value)
+	{
+		*length = blob.size();
+		return ESP_OK;
+	}
+	if(*length < blob.size()) return ESP_ERR_NVS_INVALID_LENGTH;
+	memcpy(out_value, blob.data(), blob.size());
+	*length = blob.size();
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	if(!handle || handle > nvs_handles.size()) return ESP_ERR_INVALID_ARG;
+	const uint8_t *v = (const uint8_t *) value;
+	nvs[nvs_handles[handle - 1]][key].assign(v, v + length);
+	return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+	std::lock_guard<std::mutex> guard(esp_mutex);
+	if(!handle || handle > nvs_handles.size()) return ESP_ERR_INVALID_ARG;
+	return nvs[nvs_handles[handle - 1]].erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t uart_set_pin(uart_port_t uart, int tx, int rx, int rts, int cts)
+{
+	return ESP_OK;
+}
+
+esp_err_t uart_set_hw_flow_ctrl(uart_port_t uart, uart_hw_flowcontrol_t flow, uint8_t rx_thresh)
+{
+	host_uart::get(uart).set_flow_control(flow == UART_HW_FLOWCTRL_CTS_RTS);
+	return ESP_OK;
+}
+
+esp_err_t uart_set_loop_back(uart_port_t uart, bool loop_back)
+{
+	return ESP_OK;
+}
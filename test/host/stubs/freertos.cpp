@@ -0,0 +1,322 @@
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+struct host_task
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+	uint32_t notify = 0;
+	bool notified = false;
+	TaskFunction_t fn = nullptr;
+	void *arg = nullptr;
+};
+
+struct host_semaphore
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+	UBaseType_t count;
+	UBaseType_t max;
+	bool is_mutex;
+	host_task *holder = nullptr;
+	UBaseType_t depth = 0;
+};
+
+struct host_queue
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	std::deque<std::vector<uint8_t> > items;
+};
+
+static thread_local host_task *current = nullptr;
+
+// wait on cv until ready() or the ticks run out, portMAX_DELAY waits for ever
+template <typename F> static bool wait_for(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, F ready)
+{
+	if(ticks == portMAX_DELAY)
+	{
+		cv.wait(lock, ready);
+		return true;
+	}
+	return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+}
+
+void host_critical_enter(portMUX_TYPE *mux)
+{
+	while(__sync_lock_test_and_set(&mux->owner, 1)) std::this_thread::yield();
+}
+
+void host_critical_exit(portMUX_TYPE *mux)
+{
+	__sync_lock_release(&mux->owner);
+}
+
+static void task_main(host_task *task)
+{
+	current = task;
+	task->fn(task->arg);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+	host_task *task = new host_task;
+	task->fn = fn;
+	task->arg = arg;
+	if(handle) *handle = task;
+	std::thread(task_main, task).detach();
+	return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+	return xTaskCreate(fn, name, stack, arg, priority, handle);
+}
+
+// tasks only ever delete themselves as their last statement
+void vTaskDelete(TaskHandle_t handle)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount()
+{
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+	if(!current) current = new host_task;
+	return current;
+}
+
+void taskYIELD()
+{
+	std::this_thread::yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+	return xTaskNotify(handle, 0, eIncrement);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t handle, uint32_t value, eNotifyAction action)
+{
+	std::lock_guard<std::mutex> guard(handle->mutex);
+	switch(action)
+	{
+		case eSetBits: handle->notify |= value; break;
+		case eIncrement: handle->notify++; break;
+		case eSetValueWithOverwrite: handle->notify = value; break;
+		case eSetValueWithoutOverwrite:
+			if(handle->notified) return pdFAIL;
+			handle->notify = value;
+			break;
+		default: break;
+	}
+	handle->notified = true;
+	handle->cv.notify_all();
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	host_task *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->mutex);
+	wait_for(task->cv, lock, ticks, [task] { return task->notify != 0; });
+	uint32_t value = task->notify;
+	if(value) task->notify = clear ? 0 : value - 1;
+	task->notified = false;
+	return value;
+}
+
+static SemaphoreHandle_t semaphore(UBaseType_t max, UBaseType_t initial, bool is_mutex)
+{
+	host_semaphore *sem = new host_semaphore;
+	sem->count = initial;
+	sem->max = max;
+	sem->is_mutex = is_mutex;
+	return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+	return semaphore(1, 1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+	return semaphore(1, 1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+	return semaphore(1, 0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	return semaphore(max, initial, false);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	std::unique_lock<std::mutex> lock(sem->mutex);
+	if(!wait_for(sem->cv, lock, ticks, [sem] { return sem->count > 0; })) return pdFALSE;
+	sem->count--;
+	if(sem->is_mutex) sem->holder = xTaskGetCurrentTaskHandle();
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	std::lock_guard<std::mutex> guard(sem->mutex);
+	if(sem->count >= sem->max) return pdFALSE;
+	sem->count++;
+	sem->holder = nullptr;
+	sem->cv.notify_all();
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	host_task *self = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(sem->mutex);
+	if(sem->holder == self)
+	{
+		sem->depth++;
+		return pdTRUE;
+	}
+	if(!wait_for(sem->cv, lock, ticks, [sem] { return sem->count > 0; })) return pdFALSE;
+	sem->count--;
+	sem->holder = self;
+	sem->depth = 1;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+	std::lock_guard<std::mutex> guard(sem->mutex);
+	if(sem->holder != xTaskGetCurrentTaskHandle()) return pdFALSE;
+	if(--sem->depth) return pdTRUE;
+	sem->holder = nullptr;
+	sem->count++;
+	sem->cv.notify_all();
+	return pdTRUE;
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t sem)
+{
+	std::lock_guard<std::mutex> guard(sem->mutex);
+	return sem->holder;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem)
+{
+	std::lock_guard<std::mutex> guard(sem->mutex);
+	return sem->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+	delete sem;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	host_queue *queue = new host_queue;
+	queue->length = length;
+	queue->item_size = item_size;
+	return queue;
+}
+
+static BaseType_t queue_put(QueueHandle_t queue, const void *item, TickType_t ticks, bool front)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	if(!wait_for(queue->cv, lock, ticks, [queue] { return queue->items.size() < queue->length; })) return pdFALSE;
+	const uint8_t *p = (const uint8_t *) item;
+	std::vector<uint8_t> copy(p, p + queue->item_size);
+	if(front) queue->items.push_front(copy);
+	else queue->items.push_back(copy);
+	queue->cv.notify_all();
+	return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	return queue_put(queue, item, ticks, true);
+}
+
+static BaseType_t queue_get(QueueHandle_t queue, void *item, TickType_t ticks, bool remove)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	if(!wait_for(queue->cv, lock, ticks, [queue] { return !queue->items.empty(); })) return pdFALSE;
+	memcpy(item, queue->items.front().data(), queue->item_size);
+	if(remove)
+	{
+		queue->items.pop_front();
+		queue->cv.notify_all();
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	return queue_get(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	return queue_get(queue, item, ticks, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> guard(queue->mutex);
+	queue->items.clear();
+	queue->cv.notify_all();
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> guard(queue->mutex);
+	return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> guard(queue->mutex);
+	return queue->length - queue->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	delete queue;
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_ESP_H
+#define HOST_ESP_H
+
+#include <stdint.h>
+#include <string>
+#include "esp_partition.h"
+
+/**
+* Test hooks into the host stand-ins for flash, NVS, OTA and GPIO.
+*/
+
+/*adds a data partition of size bytes, erased*/
+const esp_partition_t *host_partition_add(const char *label, uint32_t size);
+/*forgets every NVS namespace*/
+void host_nvs_clear();
+/*the image written through esp_ota_write since the last esp_ota_begin*/
+const std::string &host_ota_image();
+/*drives an input pin from the outside, running its interrupt handler*/
+void host_pin_set(uint8_t pin, int level);
+int host_pin_get(uint8_t pin);
+
+#endif //HOST_ESP_H
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include "host_uart.h"
+
+#define HOST_UART_COUNT 4
+#define HOST_UART_FIFO 128
+#define HOST_UART_TX_SLICE 2000
+
+uint64_t host_micros()
+{
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+host_uart &host_uart::get(int n)
+{
+	static host_uart uarts[HOST_UART_COUNT];
+	return uarts[n % HOST_UART_COUNT];
+}
+
+void host_uart::begin(uint32_t baud)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_baud = baud;
+	_started = true;
+}
+
+void host_uart::end()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_started = false;
+	_rx.clear();
+}
+
+void host_uart::set_baud(uint32_t baud)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	_baud = baud;
+}
+
+uint32_t host_uart::baud()
+{
+	return _baud;
+}
+
+// the ESP32 core refuses to resize a running driver
+size_t host_uart::set_rx_buffer(size_t size)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	if(_started)
+	{
+		_stats.late_resize++;
+		return 0;
+	}
+	_rx_size = size;
+	return size;
+}
+
+void host_uart::set_flow_control(bool on)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	_flow = on;
+}
+
+bool host_uart::flow_control()
+{
+	return _flow;
+}
+
+bool host_uart::started()
+{
+	return _started;
+}
+
+// move the device bytes that are due into the RX buffer
+void host_uart::pump()
+{
+	uint64_t now = host_micros();
+	size_t capacity = _rx_size + HOST_UART_FIFO;
+	while(!_pending.empty())
+	{
+		pending &p = _pending.front();
+		uint64_t byte_us = _pace ? 10000000ULL / p.baud : 0;
+		uint64_t start = std::max(_line_us, p.ready_us);
+		if(start + byte_us > now) break;
+		if(_rx.size() >= capacity)
+		{
+			if(_flow)
+			{
+				// RTS is up, the device waits for room
+				if(!_held_since) _held_since = now;
+				break;
+			}
+			_stats.overruns++;
+			_line_us = start + byte_us;
+			_pending.pop_front();
+			continue;
+		}
+		if(_held_since)
+		{
+			// RTS dropped just now, the device resumes from here
+			_stats.held_ms += (now - _held_since) / 1000;
+			_held_since = 0;
+			_line_us = now;
+			continue;
+		}
+		uint8_t c = p.c;
+		if(p.baud != _baud || (_noise && rand() % 1000 < _noise))
+		{
+			c |= 0x80;
+			_stats.garbled++;
+		}
+		_rx.push_back(c);
+		_stats.rx_bytes++;
+		_line_us = start + byte_us;
+		_pending.pop_front();
+	}
+}
+
+bool host_uart::stalled()
+{
+	return host_micros() < _stall_until;
+}
+
+int host_uart::available()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	if(stalled()) return 0;
+	return _rx.size();
+}
+
+int host_uart::read()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	if(stalled() || _rx.empty()) return -1;
+	uint8_t c = _rx.front();
+	_rx.pop_front();
+	if(_stall_armed && !--_stall_after)
+	{
+		_stall_armed = false;
+		_stall_until = host_micros() + (uint64_t) _stall_ms * 1000;
+	}
+	return c;
+}
+
+int host_uart::peek()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	if(stalled() || _rx.empty()) return -1;
+	return _rx.front();
+}
+
+size_t host_uart::write(const uint8_t *data, size_t len)
+{
+	uint64_t held = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		std::unique_lock<std::recursive_mutex> guard(_mutex);
+		if(!_device) continue;
+		if(!_device->ready())
+		{
+			if(!_flow)
+			{
+				_stats.tx_lost++;
+				continue;
+			}
+			// CTS is down, the writer blocks like the UART driver does
+			uint64_t since = host_micros();
+			while(!_device->ready())
+			{
+				guard.unlock();
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				guard.lock();
+			}
+			held += host_micros() - since;
+		}
+		uint8_t c = data[i];
+		if(_baud != _device_baud)
+		{
+			c |= 0x80;
+			_stats.garbled++;
+		}
+		_stats.tx_bytes++;
+		if(_pace) _tx_debt_us += 10000000ULL / _baud;
+		_device->receive(c);
+	}
+	std::unique_lock<std::recursive_mutex> guard(_mutex);
+	_stats.held_ms += held / 1000;
+	if(_tx_debt_us > HOST_UART_TX_SLICE)
+	{
+		uint64_t debt = _tx_debt_us;
+		_tx_debt_us = 0;
+		guard.unlock();
+		std::this_thread::sleep_for(std::chrono::microseconds(debt));
+	}
+	return len;
+}
+
+void host_uart::attach(host_device *device)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_device = device;
+}
+
+host_device *host_uart::device()
+{
+	return _device;
+}
+
+void host_uart::device_baud(uint32_t baud)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_device_baud = baud;
+}
+
+uint32_t host_uart::device_rate()
+{
+	return _device_baud;
+}
+
+// chunks are kept in order of their due time, a reply can overtake a delayed URC
+void host_uart::send(const uint8_t *data, size_t len, uint32_t delay_ms)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	uint64_t ready = host_micros() + (uint64_t) delay_ms * 1000;
+	std::deque<pending>::iterator at = _pending.end();
+	while(at != _pending.begin() && (at - 1)->ready_us > ready) at--;
+	std::deque<pending> chunk;
+	for(size_t i = 0; i < len; i++) chunk.push_back({data[i], _device_baud, ready});
+	_pending.insert(at, chunk.begin(), chunk.end());
+}
+
+void host_uart::pace(bool on)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_pace = on;
+}
+
+void host_uart::stall(uint32_t after_bytes, uint32_t ms)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_stall_after = after_bytes ? after_bytes : 1;
+	_stall_ms = ms;
+	_stall_armed = true;
+}
+
+void host_uart::noise(uint16_t per_mille)
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_noise = per_mille;
+}
+
+host_uart_stats host_uart::stats()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	pump();
+	return _stats;
+}
+
+void host_uart::reset()
+{
+	std::lock_guard<std::recursive_mutex> guard(_mutex);
+	_device = nullptr;
+	_started = false;
+	_flow = false;
+	_pace = true;
+	_baud = 115200;
+	_device_baud = 115200;
+	_rx_size = 256;
+	_noise = 0;
+	_pending.clear();
+	_rx.clear();
+	_line_us = 0;
+	_tx_debt_us = 0;
+	_held_since = 0;
+	_stall_armed = false;
+	_stall_until = 0;
+	_stats = {};
+}
@@ -0,0 +1,106 @@
+#ifndef HOST_UART_H
+#define HOST_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <mutex>
+
+/*the modem end of a host_uart*/
+class host_device
+{
+public:
+	virtual ~host_device() {}
+	/*a byte written by the ESP32 side, possibly garbled by a rate mismatch*/
+	virtual void receive(uint8_t c) = 0;
+	/*false while the device cannot take input; with flow control the writer waits*/
+	virtual bool ready() { return true; }
+};
+
+struct host_uart_stats
+{
+	uint32_t tx_bytes;       // ESP32 to device
+	uint32_t rx_bytes;       // device to ESP32, delivered into the RX buffer
+	uint32_t overruns;       // dropped because the RX buffer was full
+	uint32_t tx_lost;        // dropped because the device was not ready
+	uint32_t garbled;        // bytes sent at a rate the other side did not use
+	uint32_t held_ms;        // time the device was held back by RTS
+	uint32_t late_resize;    // setRxBufferSize calls after begin, refused
+};
+
+/**
+* In-memory UART between HardwareSerial and an emulated device. Device
+* bytes are paced at the line rate (10 bits per byte) and land in an RX
+* buffer of the size set by setRxBufferSize plus the hardware FIFO; when
+* it is full they are dropped, or held back while RTS/CTS flow control
+* is enabled. stall() stops the reader for a while to model a busy task.
+*/
+class host_uart
+{
+public:
+	static host_uart &get(int n);
+
+	// ESP32 side
+	void begin(uint32_t baud);
+	void end();
+	void set_baud(uint32_t baud);
+	uint32_t baud();
+	size_t set_rx_buffer(size_t size);
+	void set_flow_control(bool on);
+	bool flow_control();
+	int available();
+	int read();
+	int peek();
+	size_t write(const uint8_t *data, size_t len);
+	bool started();
+
+	// device side
+	void attach(host_device *device);
+	host_device *device();
+	void device_baud(uint32_t baud);
+	uint32_t device_rate();
+	void send(const uint8_t *data, size_t len, uint32_t delay_ms = 0);
+	void pace(bool on);
+	void stall(uint32_t after_bytes, uint32_t ms);
+	/*chance per byte, in 1/1000, of a bit error on the way to the ESP32*/
+	void noise(uint16_t per_mille);
+
+	host_uart_stats stats();
+	void reset();
+
+private:
+	struct pending
+	{
+		uint8_t c;
+		uint32_t baud;
+		uint64_t ready_us;
+	};
+
+	std::recursive_mutex _mutex;
+	host_device *_device = nullptr;
+	bool _started = false;
+	bool _flow = false;
+	bool _pace = true;
+	uint32_t _baud = 115200;
+	uint32_t _device_baud = 115200;
+	size_t _rx_size = 256;
+	uint16_t _noise = 0;
+	std::deque<pending> _pending;
+	std::deque<uint8_t> _rx;
+	uint64_t _line_us = 0;
+	uint64_t _tx_debt_us = 0;
+	uint64_t _held_since = 0;
+	uint32_t _stall_after = 0;
+	uint32_t _stall_ms = 0;
+	bool _stall_armed = false;
+	uint64_t _stall_until = 0;
+	host_uart_stats _stats = {};
+
+	void pump();
+	bool stalled();
+};
+
+/*microseconds since the harness started, the clock behind millis()*/
+uint64_t host_micros();
+
+#endif //HOST_UART_H
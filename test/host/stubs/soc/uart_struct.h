@@ -0,0 +1,4 @@
+#ifndef HOST_SOC_UART_STRUCT_H
+#define HOST_SOC_UART_STRUCT_H
+
+#endif //HOST_SOC_UART_STRUCT_H
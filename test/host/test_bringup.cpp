@@ -0,0 +1,53 @@
+#include "sim800.h"
+#include "sim800_apn.h"
+#include "sim800_emulator.h"
+#include "check.h"
+
+/**
+* gsm_init() on the emulator: right after a reboot it waits for Call
+* Ready and SMS Ready before the SMS and call settings, which the modem
+* refuses earlier; on a modem that is long up it does not wait. Operator
+* ids keep the number of MNC digits apart. Once the estimator trusts the
+* CIFSR round trip, a lost answer is polled again after its rto instead
+* of SIM800_SERIAL_TIMEOUT.
+*/
+int main()
+{
+	sim800_emulator emu(SIM800_UART);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+
+	CHECK_EQ(apn_plmn("25001"), SIM800_PLMN(250, 1, 2));
+	CHECK_EQ(apn_plmn("310410"), SIM800_PLMN(310, 410, 3));
+	CHECK(apn_plmn("310041") != apn_plmn("31041"));
+	CHECK(apn_lookup(apn_plmn(emu.op.c_str())) != NULL);
+
+	uint32_t start = millis();
+	CHECK(modem.gsm_init());
+	uint32_t warm = millis() - start;
+	CHECK_EQ(emu.not_ready, 0);
+
+	start = millis();
+	modem.reset(true);
+	CHECK(modem.gsm_init());
+	CHECK_EQ(emu.not_ready, 0);
+	CHECK(millis() - start >= emu.call_ready_ms + 100);
+	CHECK(warm < emu.call_ready_ms);
+	uint32_t reboot = millis() - start;
+
+	modem.clear_rtt();
+	for(int i = 0; i < SIM800_RTT_TRUST; i++)
+	{
+		CHECK(modem.connect("host", 7));
+		modem.disconnect();
+	}
+	emu.script("AT+CIFSR", "");
+	start = millis();
+	CHECK(modem.connect("host", 7));
+	uint32_t lost = millis() - start;
+	modem.disconnect();
+	CHECK(lost < SIM800_SERIAL_TIMEOUT);
+	printf("bringup ok, %u ms up, %u ms after a reboot, %u ms past a lost CIFSR\n", warm, reboot, lost);
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* The status task refreshing every value while the application downloads
+* and posts: command lines must not interleave, bodies arrive intact, the
+* cached values are the modem's, a clock URC is stored by the next
+* refresh and status_stop() returns with the task gone.
+*/
+int main()
+{
+	std::string body = bench_payload(16 * 1024);
+	sim800_emulator emu(SIM800_UART);
+	emu.action_latency = 50;
+	emu.serve("http://host/file", body);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+
+	// a clock URC arriving with a reply is stashed, then stored by a refresh
+	modem.status_ttl(SIM800_STATUS_CLOCK, 60000);
+	modem.status_refresh(true);
+	emu.latency_for("AT+CSQ", 100);
+	emu.urc("*PSUTTZ: 2024,6,2,9,30,15,\"+8\",0", 30);
+	int ber = 0;
+	CHECK_EQ(modem.get_signal(ber), emu.rssi);
+	emu.latency_for("AT+CSQ", emu.latency);
+	modem.status_refresh();
+	sim800_clock clock;
+	CHECK(modem.status_clock(clock));
+	CHECK_STR(clock.time, "09:30:15");
+	CHECK_STR(clock.date, "24/06/02");
+
+	for(uint8_t item = SIM800_STATUS_SIGNAL; item <= SIM800_STATUS_LOCATION; item++) modem.status_ttl(item, 30);
+	uint32_t before = emu.count("AT+CBC");
+	CHECK(modem.status_start(10, false));
+	for(int round = 0; round < 3; round++)
+	{
+		bench_sink sink;
+		sink.keep = true;
+		unsigned long int length = 0;
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+		CHECK(sink.data == body);
+		std::string post = body.substr(0, 1024);
+		CHECK_EQ(modem.HTTP_post("http://host/post", &length, (char *) post.data(), post.size()), 200);
+		CHECK(emu.posts.back().second == post);
+		delay(100);// the status task gets the UART between requests
+	}
+	uint32_t refreshes = emu.count("AT+CBC") - before;
+	CHECK(refreshes >= 2);
+	for(uint8_t item = SIM800_STATUS_SIGNAL; item <= SIM800_STATUS_LOCATION; item++) modem.status_ttl(item, 60000);
+
+	sim800_signal signal;
+	CHECK(modem.status_signal(signal));
+	CHECK_EQ(signal.rssi, emu.rssi);
+	sim800_battery battery;
+	CHECK(modem.status_battery(battery));
+	CHECK_EQ(battery.percent, 80);
+	CHECK_EQ(battery.voltage, 4100);
+	sim800_registration registration;
+	CHECK(modem.status_registration(registration));
+	CHECK_EQ(registration.stat, 1);
+
+	modem.status_stop();
+	uint32_t after = emu.count("AT+CBC");
+	delay(100);
+	CHECK_EQ(emu.count("AT+CBC"), after);
+	CHECK(modem.status_start(10, false));
+	modem.status_stop();
+
+	// every line the modem saw is one whole command
+	for(const std::string &cmd : emu.commands())
+	{
+		CHECK(cmd.compare(0, 2, "AT") == 0);
+		CHECK(cmd.find("AT+", 1) == std::string::npos);
+	}
+	printf("concurrency ok, %u status refreshes during the transfers\n", refreshes);
+	return 0;
+}
@@ -0,0 +1,43 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* HTTP_get into a stream reports 1011 when the body cannot be read up to
+* the announced length: a HTTPREAD answered with ERROR reads nothing and
+* is retried, an oversized range gives up at once.
+*/
+int main()
+{
+	std::string body = bench_payload(4096);
+	sim800_emulator emu(SIM800_UART);
+	emu.rssi = 31;
+	emu.serve("http://host/file", body);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+	unsigned long int length = 0;
+
+	{
+		bench_sink sink;
+		emu.script("AT+HTTPREAD", "ERROR");
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+		CHECK_EQ(sink.count, body.size());
+	}
+	{
+		bench_sink sink;
+		emu.script("AT+HTTPREAD", "+HTTPREAD: 999999\nOK");
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 1011);
+	}
+	{
+		bench_sink sink;
+		for(int i = 0; i < SIM800_LINK_BANDS + 1; i++) emu.script("AT+HTTPREAD", "ERROR");
+		CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 1011);
+		CHECK_EQ(length, body.size());
+		CHECK_EQ(sink.count, 0);
+	}
+	printf("http ok\n");
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <string>
+#include <vector>
+#include "sim800.h"
+#include "sim800_mqtt.h"
+#include "sim800_emulator.h"
+#include "check.h"
+
+/**
+* sim800_mqtt against a scripted broker on the emulator's TCP socket:
+* CONNECT/CONNACK, batched QoS0 and acknowledged QoS1 publishes, a
+* subscription answered with a QoS1 publish the client acknowledges, an
+* oversized packet skipped without losing the stream, keepalive pings
+* and DISCONNECT.
+*/
+struct broker
+{
+	std::string in;
+	std::vector<std::pair<std::string, std::string> > published;
+	uint32_t pubacks = 0;
+	uint32_t pings = 0;
+	bool disconnected = false;
+
+	static std::string packet(uint8_t type, const std::string &body)
+	{
+		std::string p(1, (char) type);
+		size_t n = body.size();
+		do
+		{
+			uint8_t b = n & 0x7f;
+			n >>= 7;
+			p += (char) (b | (n ? 0x80 : 0));
+		}
+		while(n);
+		return p + body;
+	}
+
+	static std::string str(const std::string &s)
+	{
+		return std::string(1, (char) (s.size() >> 8)) + (char) (s.size() & 0xff) + s;
+	}
+
+	void receive(sim800_emulator &emu, const std::string &data)
+	{
+		in += data;
+		std::string out;
+		while(in.size() >= 2)
+		{
+			size_t remaining = 0, i = 1;
+			uint8_t shift = 0, b;
+			do
+			{
+				b = in[i++];
+				remaining |= (size_t) (b & 0x7f) << shift;
+				shift += 7;
+			}
+			while(b & 0x80);
+			if(in.size() < i + remaining) break;
+			uint8_t type = in[0];
+			std::string body = in.substr(i, remaining);
+			in.erase(0, i + remaining);
+			switch(type & 0xf0)
+			{
+				case MQTT_CONNECT:
+					out += packet(MQTT_CONNACK, std::string("\0\0", 2));
+					break;
+				case MQTT_PUBLISH:
+				{
+					uint8_t qos = (type >> 1) & 0x03;
+					size_t len = ((uint8_t) body[0] << 8) | (uint8_t) body[1];
+					std::string topic = body.substr(2, len);
+					published.push_back(std::make_pair(topic, body.substr(2 + len + (qos ? 2 : 0))));
+					if(qos) out += packet(MQTT_PUBACK, body.substr(2 + len, 2));
+					break;
+				}
+				case MQTT_PUBACK:
+					pubacks++;
+					break;
+				case MQTT_SUBSCRIBE & 0xf0:
+				{
+					size_t len = ((uint8_t) body[2] << 8) | (uint8_t) body[3];
+					std::string topic = body.substr(4, len);
+					out += packet(MQTT_SUBACK, body.substr(0, 2) + body.substr(4 + len, 1));
+					out += packet(MQTT_PUBLISH | 0x02, str(topic) + std::string("\x12\x34", 2) + "on");
+					out += packet(MQTT_PUBLISH, str(topic) + std::string(MQTT_RX_BUFFSIZE, 'x'));
+					out += packet(MQTT_PUBLISH, str(topic) + "off");
+					break;
+				}
+				case MQTT_PINGREQ:
+					pings++;
+					out += packet(MQTT_PINGRESP, "");
+					break;
+				case MQTT_DISCONNECT:
+					disconnected = true;
+					break;
+			}
+		}
+		if(!out.empty()) emu.tcp_push(out);
+	}
+};
+
+static std::vector<std::string> received;
+
+static void on_message(const char *topic, uint16_t topic_len, const uint8_t *payload, size_t len)
+{
+	received.push_back(std::string(topic, topic_len) + "=" + std::string((const char *) payload, len));
+}
+
+int main()
+{
+	sim800_emulator emu(SIM800_UART);
+	broker b;
+	emu.on_tcp = [&](sim800_emulator &e, const std::string &data) { b.receive(e, data); };
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+
+	sim800_mqtt mqtt(modem);
+	mqtt.set_callback(on_message);
+	CHECK(mqtt.connect("broker", 1883, "dev1", NULL, NULL, 2));
+	CHECK(mqtt.connected());
+
+	// QoS0 publishes go out together with the next flush
+	uint32_t sends = emu.count("AT+CIPSEND");
+	CHECK(mqtt.publish("t/a", (const uint8_t *) "1", 1));
+	CHECK(mqtt.publish("t/b", (const uint8_t *) "2", 1));
+	CHECK(mqtt.flush());
+	CHECK_EQ(emu.count("AT+CIPSEND"), sends + 1);
+	CHECK_EQ(b.published.size(), 2);
+	CHECK(b.published[1].first == "t/b" && b.published[1].second == "2");
+
+	const char *payload = "21.5";
+	CHECK(mqtt.publish("t/q1", (const uint8_t *) payload, 4, 1));
+	CHECK_EQ(mqtt.inflight(), 1);
+	CHECK(mqtt.flush());
+	for(int i = 0; i < 50 && mqtt.inflight(); i++) mqtt.loop();
+	CHECK_EQ(mqtt.inflight(), 0);
+	CHECK(b.published.back().second == "21.5");
+
+	CHECK(mqtt.subscribe("cmd"));
+	for(int i = 0; i < 50 && received.size() < 2; i++) mqtt.loop();
+	CHECK_EQ(received.size(), 2);
+	CHECK(received[0] == "cmd=on");
+	CHECK(received[1] == "cmd=off");
+	CHECK_EQ(mqtt.dropped, 1);
+	for(int i = 0; i < 10 && !b.pubacks; i++) mqtt.loop();
+	CHECK_EQ(b.pubacks, 1);
+
+	// keepalive 2 s: a ping after 1.5 s idle, answered
+	uint32_t start = millis();
+	while(millis() - start < 2500)
+	{
+		CHECK(mqtt.loop());
+		delay(50);
+	}
+	CHECK(mqtt.pings >= 1);
+	CHECK_EQ(b.pings, mqtt.pings);
+	CHECK(mqtt.connected());
+
+	mqtt.disconnect();
+	CHECK(!mqtt.connected());
+	CHECK(b.disconnected);
+	CHECK(!emu.tcp_open);
+	printf("mqtt ok, %u pings\n", mqtt.pings);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_pool.h"
+#include "sim800_emulator.h"
+#include "check.h"
+
+/**
+* A pool of two modems only repeats a transfer on the other one when the
+* data never left the first: a post failing after its body was sent and a
+* send failing after the connect reach the server once, unless
+* at_least_once is set.
+*/
+int main()
+{
+	sim800_board board_a = SIM800_BOARD_DEFAULT, board_b = SIM800_BOARD_DEFAULT;
+	board_a.uart = 1;
+	board_b.uart = 2;
+	sim800_emulator a(1), b(2);
+	sim800 modem_a(board_a), modem_b(board_b);
+	modem_a.begin();
+	modem_b.begin();
+	CHECK(modem_a.expect_AT_OK(F("")));
+	CHECK(modem_b.expect_AT_OK(F("")));
+	sim800_pool pool;
+	CHECK(pool.add(modem_a));
+	CHECK(pool.add(modem_b));
+	std::string body = "t=21.5";
+	unsigned long int length = 0;
+
+	// the body went out, the server's answer is a 6xx: no second copy
+	a.on_post = [](const std::string &url, const std::string &body, std::string &response) { return 603; };
+	CHECK_EQ(pool.HTTP_post("http://host/post", &length, (char *) body.data(), body.size()), 603);
+	CHECK_EQ(a.posts.size(), 1);
+	CHECK_EQ(b.posts.size(), 0);
+	CHECK_EQ(pool.failovers, 0);
+
+	// HTTPINIT failed, nothing was sent: the other modem posts it
+	a.script("AT+HTTPINIT", "ERROR");
+	CHECK_EQ(pool.HTTP_post("http://host/post", &length, (char *) body.data(), body.size()), 200);
+	CHECK_EQ(a.posts.size(), 1);
+	CHECK_EQ(b.posts.size(), 1);
+	CHECK_EQ(pool.failovers, 1);
+
+	// at least once: the 6xx post is repeated
+	pool.at_least_once = true;
+	CHECK_EQ(pool.HTTP_post("http://host/post", &length, (char *) body.data(), body.size()), 200);
+	CHECK_EQ(a.posts.size(), 2);
+	CHECK_EQ(b.posts.size(), 2);
+	CHECK_EQ(pool.failovers, 2);
+	pool.at_least_once = false;
+	a.on_post = nullptr;
+
+	// a send only fails over when the connect failed
+	unsigned long int accepted = 0;
+	a.script("AT+CIPSTART", "ERROR");
+	CHECK(pool.send("host", 7, (char *) body.data(), body.size(), accepted));
+	CHECK(a.tcp_sent.empty());
+	CHECK(b.tcp_sent == body);
+	CHECK_EQ(pool.failovers, 3);
+	b.tcp_sent.clear();
+	a.script("AT+CIPSEND", "ERROR");
+	CHECK(!pool.send("host", 7, (char *) body.data(), body.size(), accepted));
+	CHECK(b.tcp_sent.empty());
+	CHECK_EQ(pool.failovers, 3);
+
+	sim800_pool_stats stats;
+	pool.report(0, stats);
+	CHECK(stats.up);
+	CHECK_EQ(stats.health, 100);
+	CHECK_EQ(stats.inflight, 0);
+	printf("pool ok\n");
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_spool.h"
+#include "sim800_emulator.h"
+#include "host_esp.h"
+#include "check.h"
+
+/**
+* The spool in a two sector partition: a flush body is length-prefixed
+* records, a failed post keeps them, an overwritten sector drops its
+* oldest records and a ring filled up while a flush held its sector is
+* sent as a whole.
+*/
+static std::string record(uint32_t i)
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), "r%u", i);
+	return buf;
+}
+
+static std::string framed(uint32_t from, uint32_t to)
+{
+	std::string body;
+	for(uint32_t i = from; i < to; i++)
+	{
+		std::string r = record(i);
+		body += (char) r.size();
+		body += r;
+	}
+	return body;
+}
+
+int main()
+{
+	const uint32_t slots = 2 * SIM800_SPOOL_SECTOR / SIM800_SPOOL_RECORD;
+	host_partition_add(SIM800_SPOOL_LABEL, 2 * SIM800_SPOOL_SECTOR);
+	sim800_emulator emu(SIM800_UART);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+	sim800_spool spool;
+	CHECK(spool.begin());
+	CHECK_EQ(spool.flush(modem, "http://host/spool"), 0);
+
+	uint32_t n = 0;
+	for(; n < 3; n++) CHECK(spool.append((const uint8_t *) record(n).data(), record(n).size()));
+	emu.post_status = 500;
+	CHECK_EQ(spool.flush(modem, "http://host/spool"), 500);
+	CHECK_EQ(spool.backlog(), 3);
+	emu.post_status = 200;
+	CHECK_EQ(spool.flush(modem, "http://host/spool"), 200);
+	CHECK(emu.posts.back().second == framed(0, 3));
+	CHECK_EQ(spool.backlog(), 0);
+	CHECK_EQ(spool.flush(modem, "http://host/spool"), 0);
+
+	// wrapping onto the tail's sector drops the records in it
+	uint32_t from = n;
+	for(uint32_t i = 0; i < slots + 1; i++, n++) CHECK(spool.append((const uint8_t *) record(n).data(), record(n).size()));
+	sim800_spool_stats stats;
+	spool.report(stats);
+	CHECK(stats.dropped > 0);
+	CHECK_EQ(stats.backlog + stats.dropped, n - 3);
+	from += stats.dropped;
+	CHECK_EQ(spool.flush(modem, "http://host/spool"), 200);
+	CHECK(emu.posts.back().second == framed(from, n));
+	CHECK_EQ(spool.backlog(), 0);
+
+	// appends during a failing flush fill the ring up to the batch's
+	// sector, the next flush sends the whole ring
+	host_partition_add("spool2", 2 * SIM800_SPOOL_SECTOR);
+	sim800_spool full;
+	CHECK(full.begin("spool2"));
+	from = n;
+	for(uint32_t i = 0; i < slots / 2; i++, n++) CHECK(full.append((const uint8_t *) record(n).data(), record(n).size()));
+	emu.on_post = [&](const std::string &url, const std::string &body, std::string &response)
+	{
+		while(full.append((const uint8_t *) record(n).data(), record(n).size())) n++;
+		return 500;
+	};
+	CHECK_EQ(full.flush(modem, "http://host/spool"), 500);
+	emu.on_post = nullptr;
+	full.report(stats);
+	CHECK_EQ(stats.failures, 1);
+	CHECK_EQ(stats.dropped, 1);
+	CHECK_EQ(full.backlog(), slots);
+	CHECK_EQ(full.flush(modem, "http://host/spool"), 200);
+	CHECK(emu.posts.back().second == framed(from, n));
+	CHECK_EQ(full.backlog(), 0);
+	CHECK_EQ(full.flush(modem, "http://host/spool"), 0);
+	printf("spool ok, %u records\n", n);
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "check.h"
+
+/**
+* stats_snapshot() against the emulator: command classes and counts,
+* the latency histogram of AT+HTTPACTION, timeouts, retries of a failed
+* command, URC counters and the UART byte totals.
+*/
+static uint32_t buckets(const sim800_cmd_stats &c)
+{
+	uint32_t n = 0;
+	for(uint8_t i = 0; i < SIM800_LATENCY_BUCKETS; i++) n += c.latency[i];
+	return n;
+}
+
+int main()
+{
+	sim800_emulator emu(SIM800_UART);
+	emu.action_latency = 300;
+	emu.serve("http://host/file", "0123456789");
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+	modem.stats_reset();
+	host_uart_stats before = emu.uart().stats();
+
+	sim800_stats s;
+	CHECK(modem.expect_AT_OK(F("")));
+	modem.stats_snapshot(s);
+	CHECK_EQ(s.cmd[SIM800_CMD_OTHER].count, 1);
+	CHECK_EQ(s.cmd[SIM800_CMD_OTHER].timeouts, 0);
+
+	uint16_t stat = 0;
+	CHECK(modem.registration(stat));
+	modem.stats_snapshot(s);
+	CHECK_EQ(s.cmd[SIM800_CMD_CREG].count, 1);
+
+	unsigned long int length = 0;
+	CHECK_EQ(modem.HTTP_get("http://host/file", &length), 200);
+	CHECK_EQ(length, 10);
+	modem.expect_AT_OK(F(""));// closes the accounting of the last command
+	modem.stats_snapshot(s);
+	const sim800_cmd_stats &action = s.cmd[SIM800_CMD_HTTPACTION];
+	CHECK_EQ(action.count, 1);
+	CHECK_EQ(buckets(action), 1);
+	CHECK(action.max_ms >= emu.action_latency);
+	CHECK_EQ(action.latency[0] + action.latency[1] + action.latency[2], 0);
+
+	// a command without an answer times out
+	emu.script("AT+CSQ", "");
+	int ber = 0;
+	uint32_t timeouts = s.cmd[SIM800_CMD_OTHER].timeouts;
+	modem.get_signal(ber);
+	modem.stats_snapshot(s);
+	CHECK(s.cmd[SIM800_CMD_OTHER].timeouts > timeouts);
+
+	// the same class sent again after a failure counts as a retry
+	CHECK(modem.expect_AT_OK(F("")));
+	modem.stats_snapshot(s);
+	uint32_t retries = s.cmd[SIM800_CMD_OTHER].retries;
+	CHECK(!modem.expect_AT_OK(F("+BOGUS")));
+	CHECK(!modem.expect_AT_OK(F("+BOGUS")));
+	modem.stats_snapshot(s);
+	CHECK_EQ(s.cmd[SIM800_CMD_OTHER].retries, retries + 1);
+
+	// pending input is dropped before a command, the URC has to come with the answer
+	emu.latency_for("AT+CSQ", 100);
+	emu.urc("DST: 1", 30);
+	CHECK_EQ(modem.get_signal(ber), emu.rssi);
+	modem.stats_snapshot(s);
+	CHECK_EQ(s.urc[URC_DST], 1);
+
+	host_uart_stats uart = emu.uart().stats();
+	CHECK_EQ(s.bytes_out, uart.tx_bytes - before.tx_bytes);
+	CHECK(s.bytes_in > 0 && s.bytes_in <= uart.rx_bytes - before.rx_bytes);
+
+	modem.stats_reset();
+	modem.stats_snapshot(s);
+	CHECK_EQ(s.cmd[SIM800_CMD_HTTPACTION].count, 0);
+	CHECK_EQ(s.bytes_out, 0);
+	printf("stats ok, HTTPACTION max %u ms\n", action.max_ms);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <string>
+#include "sim800.h"
+#include "host_uart.h"
+#include "check.h"
+
+/**
+* The library talks through SIM800_SERIAL to a host_uart; a device that
+* answers each command line from a fixed table is enough to check it.
+*/
+class table_device : public host_device
+{
+public:
+	table_device(host_uart &uart) : _uart(uart) {}
+
+	void receive(uint8_t c)
+	{
+		if(c == '\n') return;
+		if(c != '\r')
+		{
+			_line += (char) c;
+			return;
+		}
+		std::string reply = "\r\nERROR\r\n";
+		if(_line == "AT" || _line == "ATE0") reply = "\r\nOK\r\n";
+		else if(_line == "AT+GSN") reply = "\r\n861234567890123\r\n\r\nOK\r\n";
+		else if(_line == "AT+CIMI") reply = "\r\n25001123456789012345\r\n\r\nOK\r\n";
+		else if(_line == "AT+CBC") reply = "\r\n+CBC: 0,80,4100\r\n\r\nOK\r\n";
+		else if(_line == "AT+CSQ") reply = "\r\n+CSQ: 17,0\r\n\r\nOK\r\n";
+		_uart.send((const uint8_t *) reply.data(), reply.size(), 2);
+		_line.clear();
+	}
+
+private:
+	host_uart &_uart;
+	std::string _line;
+};
+
+int main()
+{
+	host_uart &uart = host_uart::get(SIM800_UART);
+	table_device device(uart);
+	uart.attach(&device);
+
+	sim800 modem;
+	modem.begin();
+	CHECK(uart.started());
+	CHECK(modem.expect_AT_OK(F("")));
+	CHECK(!modem.expect_AT_OK(F("+BOGUS")));
+
+	char imei[16];
+	CHECK(modem.IMEI(imei));
+	CHECK_STR(imei, "861234567890123");
+	char imsi[16 + 8];
+	memset(imsi, 'x', sizeof(imsi));
+	CHECK(modem.CIMI(imsi));// a longer answer is cut at 15 digits
+	CHECK_STR(imsi, "250011234567890");
+	CHECK_EQ(imsi[16], 'x');
+
+	uint16_t bat[5] = {0xaaaa, 0, 0, 0, 0xaaaa};// each field is scanned as 16 bits
+	CHECK(modem.battery(bat[1], bat[2], bat[3]));
+	CHECK_EQ(bat[2], 80);
+	CHECK_EQ(bat[3], 4100);
+	CHECK_EQ(bat[4], 0xaaaa);
+
+	int ber = 0;
+	CHECK_EQ(modem.get_signal(ber), 17);
+	CHECK_EQ(modem.at_commands, 6);
+
+	host_uart_stats stats = uart.stats();
+	CHECK_EQ(stats.overruns, 0);
+	CHECK(stats.rx_bytes > 0);
+	printf("transport ok, %u bytes out, %u bytes in\n", stats.tx_bytes, stats.rx_bytes);
+	return 0;
+}
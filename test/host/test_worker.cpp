@@ -0,0 +1,70 @@
+#include <thread>
+#include "sim800.h"
+#include "sim800_worker.h"
+#include "sim800_emulator.h"
+#include "check.h"
+
+/**
+* Job results reach the waiter: a job stepping until done, one that fails,
+* and one still queued when stop() joins the task.
+*/
+static uint8_t steps(sim800 &modem, void *arg)
+{
+	int *left = (int *) arg;
+	if(!modem.expect_AT_OK(F(""))) return SIM800_JOB_FAILED;
+	return --*left > 0 ? SIM800_JOB_MORE : SIM800_JOB_DONE;
+}
+
+static uint8_t fails(sim800 &modem, void *arg)
+{
+	return SIM800_JOB_FAILED;
+}
+
+static uint8_t slow(sim800 &modem, void *arg)
+{
+	delay(200);
+	return SIM800_JOB_DONE;
+}
+
+int main()
+{
+	sim800_emulator emu(SIM800_UART);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+	sim800_worker worker(modem);
+	CHECK(worker.start());
+
+	int left = 3;
+	CHECK(worker.run(0, SIM800_PRIO_NORMAL, steps, &left));
+	CHECK_EQ(left, 0);
+	CHECK(!worker.run(1, SIM800_PRIO_NORMAL, fails, NULL));
+	sim800_client_stats stats;
+	worker.client_stats(0, stats);
+	CHECK_EQ(stats.steps, 3);
+	CHECK_EQ(stats.jobs, 1);
+	CHECK_EQ(stats.failed, 0);
+	worker.client_stats(1, stats);
+	CHECK_EQ(stats.failed, 1);
+
+	// stop() waits out the slow step, the queued job fails
+	CHECK(worker.post(0, SIM800_PRIO_NORMAL, slow, NULL));
+	delay(50);
+	bool queued = true;
+	left = 1;
+	std::thread waiter([&] { queued = worker.run(2, SIM800_PRIO_NORMAL, steps, &left); });
+	delay(50);
+	CHECK_EQ(worker.pending(), 1);
+	worker.stop();
+	waiter.join();
+	CHECK(!queued);
+	CHECK_EQ(left, 1);
+	CHECK_EQ(worker.pending(), 0);
+	CHECK(!worker.run(0, SIM800_PRIO_NORMAL, steps, &left));
+
+	CHECK(worker.start());
+	CHECK(worker.run(0, SIM800_PRIO_NORMAL, steps, &left));
+	worker.stop();
+	printf("worker ok\n");
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string>
+#include "sim800.h"
+#include "sim800_emulator.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* Records a short session against the emulator with SIM800_TRACE and
+* writes the trace_dump() to the file given, for trace_replay.
+*/
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "usage: %s <dump>\n", argv[0]);
+		return 2;
+	}
+	std::string text;
+	while(text.size() < 1500) text += "the quick brown fox jumps over the lazy dog\n";
+
+	sim800_emulator emu(SIM800_UART);
+	emu.action_latency = 150;
+	emu.serve("http://host/file", text);
+	sim800 modem;
+	modem.begin();
+	CHECK(modem.expect_AT_OK(F("")));
+	modem.trace_clear();
+
+	char imei[16];
+	CHECK(modem.IMEI(imei));
+	int ber = 0;
+	CHECK_EQ(modem.get_signal(ber), emu.rssi);
+	uint16_t stat = 0;
+	CHECK(modem.registration(stat));
+	unsigned long int length = 0;
+	bench_sink sink;
+	CHECK_EQ(modem.HTTP_get("http://host/file", &length, sink), 200);
+	CHECK_EQ(sink.count, text.size());
+	std::string post = text.substr(0, 300);
+	CHECK_EQ(modem.HTTP_post("http://host/post", &length, (char *) post.data(), post.size()), 200);
+	CHECK(modem.expect_AT_OK(F("")));
+
+	bench_sink dump;
+	dump.keep = true;
+	modem.trace_dump(dump);
+	FILE *f = fopen(argv[1], "wb");
+	CHECK(f != NULL);
+	CHECK_EQ(fwrite(dump.data.data(), 1, dump.data.size(), f), dump.data.size());
+	fclose(f);
+	printf("recorded %u commands, %u bytes of trace\n", modem.at_commands, (unsigned) dump.data.size());
+	return 0;
+}
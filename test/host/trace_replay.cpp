@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "sim800.h"
+#include "bench.h"
+#include "check.h"
+
+/**
+* Plays a trace_dump() back through the library built with SIM800_REPLAY:
+* the recorded TX bytes are sent again with println(), or print() for a
+* tail without a line end such as a request body, and the replies are
+* read with readline() at their recorded pace divided by speed. Prints the
+* wall time, the bytes that differ from the recording and the command
+* statistics. usage: trace_replay <dump> [speed] [--check]
+*/
+static sim800_trace_chunk chunks[4096];
+
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "usage: %s <dump> [speed] [--check]\n", argv[0]);
+		return 2;
+	}
+	float speed = argc > 2 && argv[2][0] != '-' ? atof(argv[2]) : 1.0;
+	bool check = !strcmp(argv[argc - 1], "--check");
+	FILE *f = fopen(argv[1], "rb");
+	if(!f)
+	{
+		perror(argv[1]);
+		return 2;
+	}
+	std::string data;
+	char block[4096];
+	size_t n;
+	while((n = fread(block, 1, sizeof(block), f)) > 0) data.append(block, n);
+	fclose(f);
+
+	sim800 modem;
+	modem.begin();
+	sim800_replay &replay = modem.replay();
+	bench_source dump(data);
+	if(!replay.load(dump, chunks, sizeof(chunks) / sizeof(chunks[0]), speed))
+	{
+		fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+		return 2;
+	}
+	modem.stats_reset();
+
+	char buf[SIM800_BUFSIZE];
+	uint32_t lines = 0;
+	uint32_t replies = 0;
+	bench_clock clock;
+	for(uint32_t i = 0; !replay.done(); )
+	{
+		// the TX bytes up to the next reply, split at line ends
+		std::string tx;
+		while(const sim800_trace_chunk *c = replay.chunk(i))
+		{
+			if(c->dir != SIM800_TRACE_TX) break;
+			tx.append((const char *) c->data, c->len);
+			i++;
+		}
+		size_t pos = 0, end;
+		while((end = tx.find("\r\n", pos)) != std::string::npos)
+		{
+			modem.println(tx.substr(pos, end - pos).c_str());
+			lines++;
+			pos = end + 2;
+		}
+		if(pos < tx.size()) modem.print(tx.substr(pos).c_str());
+		while(replay.rx_pending())
+		{
+			if(modem.readline(buf, SIM800_BUFSIZE - 1, SIM800_SERIAL_TIMEOUT)) replies++;
+		}
+		while(const sim800_trace_chunk *c = replay.chunk(i))
+		{
+			if(c->dir != SIM800_TRACE_RX) break;
+			i++;
+		}
+	}
+	uint32_t wall = clock.wall();
+	uint32_t span = 0;
+	for(uint32_t i = 0; replay.chunk(i); i++) span = replay.chunk(i)->ms - replay.chunk(0)->ms;
+
+	sim800_stats s;
+	modem.stats_snapshot(s);
+	printf("replayed %u lines, %u replies in %u ms at speed %.2f (recorded %u ms), %u mismatches\n", lines, replies, wall, speed, span, replay.mismatches);
+	printf("%u bytes out, %u bytes in\n", s.bytes_out, s.bytes_in);
+	for(uint8_t cls = 0; cls < SIM800_CMD_CLASSES; cls++)
+	{
+		const sim800_cmd_stats &c = s.cmd[cls];
+		if(!c.count) continue;
+		printf("class %u: %u commands, %u retries\n", cls, c.count, c.retries);
+	}
+	if(check) CHECK_EQ(replay.mismatches, 0);
+	return 0;
+}